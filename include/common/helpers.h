@@ -16,6 +16,7 @@
 #pragma once
 
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define M_SQRT2_F ((float)M_SQRT2)
@@ -72,3 +73,7 @@ void transform_alpha_beta_to_d_q(float theta, float alpha, float beta, float* d,
 void hash_fnv_1a(uint32_t len, const uint8_t* buf, uint64_t* hash);
 uint16_t crc16_ccitt(const void *buf, size_t len, uint16_t crc);
 uint32_t crc32(const uint8_t *buf, uint32_t len, uint32_t crc);
+
+// - Formats a log2 histogram, in which bin 0 counts zeros and bin i counts values in [2^(i-1), 2^i), into buf as the counts
+//   from the first non-empty bin on, each preceded by a space. Returns the lower bound of the first formatted bin.
+uint32_t format_log2_histogram(char* buf, size_t buf_size, const uint32_t* histogram, size_t num_bins);
@@ -1,6 +1,7 @@
 #include "can.h"
 #include "can_driver.h"
 #include "can_tx_queue.h"
+#include "can_tx_deadline_heap.h"
 #include "can_helpers.h"
 #include "string.h"
 #include <common/helpers.h>
@@ -24,7 +25,13 @@ WORKER_THREAD_DECLARE_EXTERN(WT_EXPIRE)
 #define CAN_TX_QUEUE_LEN 64
 #endif
 
+// - See can_tx_queue.h. CAN_TX_QUEUE_BUCKETED keeps the cost under lock constant when CAN_TX_QUEUE_LEN is raised.
+#ifndef CAN_TX_QUEUE_TYPE
+#define CAN_TX_QUEUE_TYPE CAN_TX_QUEUE_LIST
+#endif
+
 #define MAX_NUM_TX_MAILBOXES 3
+#define MAX_NUM_RX_MAILBOXES 2
 
 enum can_tx_mailbox_state_t {
     CAN_TX_MAILBOX_EMPTY,
@@ -49,18 +56,29 @@ struct can_instance_s {
     void* driver_ctx;
     const struct can_driver_iface_s* driver_iface;
 
+    mutex_t filter_mutex;
+    struct can_filter_s* filter_list_head;
+    bool filters_committed;
+
     struct can_tx_mailbox_s tx_mailbox[MAX_NUM_TX_MAILBOXES];
     uint8_t num_tx_mailboxes;
 
     memory_pool_t frame_pool;
     struct can_tx_queue_s tx_queue;
 
+    uint8_t num_rx_mailboxes;
+    uint32_t rx_overruns[MAX_NUM_RX_MAILBOXES];
+
     struct pubsub_topic_s rx_topic;
-    struct worker_thread_publisher_task_s rx_publisher_task;
+    struct worker_thread_channel_task_s rx_channel_task;
 
-    struct worker_thread_publisher_task_s tx_publisher_task;
+    struct worker_thread_channel_task_s tx_channel_task;
 
+    struct can_tx_deadline_heap_s deadline_heap;
     struct worker_thread_timer_task_s expire_timer_task;
+    bool expire_timer_armed;
+    systime_t expire_timer_deadline;
+    uint32_t expired_tx_frames[CAN_NUM_PRIORITY_CLASSES];
 
     struct can_instance_s* next;
 };
@@ -70,10 +88,11 @@ MEMORYPOOL_DECL(can_instance_pool, sizeof(struct can_instance_s), chCoreAllocAli
 static struct can_instance_s* can_instance_list_head;
 
 static void can_expire_handler(struct worker_thread_timer_task_s* task);
-static void can_reschedule_expire_timer_I(struct can_instance_s* instance);
-static void can_reschedule_expire_timer(struct can_instance_s* instance);
+static void can_arm_expire_timer_I(struct can_instance_s* instance);
+static void can_arm_expire_timer(struct can_instance_s* instance);
 static void can_try_enqueue_waiting_frame_I(struct can_instance_s* instance);
 static void can_try_enqueue_waiting_frame(struct can_instance_s* instance);
+static void can_enable_filters_I(struct can_instance_s* instance);
 
 bool can_iterate_instances(struct can_instance_s** instance_ptr) {
     if (!instance_ptr) {
@@ -160,6 +179,53 @@ bool can_get_baudrate_confirmed(struct can_instance_s* instance) {
     return instance->baudrate_confirmed;
 }
 
+void can_add_filter(struct can_instance_s* instance, struct can_filter_s* filter) {
+    if (!instance || !filter) {
+        return;
+    }
+
+    chMtxLock(&instance->filter_mutex);
+    LINKED_LIST_APPEND(struct can_filter_s, instance->filter_list_head, filter);
+    chMtxUnlock(&instance->filter_mutex);
+}
+
+void can_remove_filter(struct can_instance_s* instance, struct can_filter_s* filter) {
+    if (!instance || !filter) {
+        return;
+    }
+
+    chMtxLock(&instance->filter_mutex);
+    LINKED_LIST_REMOVE(struct can_filter_s, instance->filter_list_head, filter);
+    chMtxUnlock(&instance->filter_mutex);
+}
+
+void can_commit_filters(struct can_instance_s* instance) {
+    if (!instance || !instance->driver_iface->set_filters) {
+        return;
+    }
+
+    chMtxLock(&instance->filter_mutex);
+    instance->driver_iface->set_filters(instance->driver_ctx, instance->filter_list_head);
+    chMtxUnlock(&instance->filter_mutex);
+
+    chSysLock();
+    instance->filters_committed = true;
+    if (instance->started && instance->baudrate_confirmed) {
+        can_enable_filters_I(instance);
+    }
+    chSysUnlock();
+}
+
+static void can_enable_filters_I(struct can_instance_s* instance) {
+    chDbgCheckClassI();
+
+    // Filters are held off until a frame has been received at the current baudrate, so that they can't hide the bus
+    // traffic that confirms it
+    if (instance->filters_committed && instance->driver_iface->enable_filters_I) {
+        instance->driver_iface->enable_filters_I(instance->driver_ctx);
+    }
+}
+
 void can_start_I(struct can_instance_s* instance, bool silent, bool auto_retransmit, uint32_t baudrate) {
     chDbgCheckClassI();
     if (!instance) {
@@ -179,6 +245,10 @@ void can_start_I(struct can_instance_s* instance, bool silent, bool auto_retrans
         instance->baudrate_confirmed = false;
     }
     instance->baudrate = baudrate;
+
+    if (instance->baudrate_confirmed) {
+        can_enable_filters_I(instance);
+    }
 }
 
 void can_start(struct can_instance_s* instance, bool silent, bool auto_retransmit, uint32_t baudrate) {
@@ -243,33 +313,48 @@ struct can_tx_frame_s* can_allocate_tx_frames(struct can_instance_s* instance, s
     return ret;
 }
 
-void can_enqueue_tx_frames(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, struct pubsub_topic_s* completion_topic) {
-    if (!instance) {
+// - The whole frame list goes into the queue, the deadline heap and, if it wins, a mailbox within one critical section.
+//   Only the last frame carries the completion topic and callback, so they fire once for the transfer.
+static void can_enqueue_tx_frame_list(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, struct pubsub_topic_s* completion_topic, can_tx_completion_cb_t completion_cb, void* completion_ctx) {
+    if (!instance || !frame_list || !*frame_list) {
         return;
     }
-    
-    systime_t t_now = chVTGetSystemTimeX();
 
-    struct can_tx_frame_s* frame = *frame_list;
-    while (frame != NULL) {
-        struct can_tx_frame_s* next_frame = frame->next;
+    systime_t t_now = chVTGetSystemTimeX();
 
+    // The frames are still private to the caller here, so they are filled in before taking the lock
+    for (struct can_tx_frame_s* frame = *frame_list; frame != NULL; frame = frame->next) {
         frame->creation_systime = t_now;
         frame->tx_timeout = tx_timeout;
         if (!frame->next) {
             frame->completion_topic = completion_topic;
+            frame->completion_cb = completion_cb;
+            frame->completion_ctx = completion_ctx;
         } else {
             frame->completion_topic = NULL;
+            frame->completion_cb = NULL;
         }
-        can_tx_queue_push(&instance->tx_queue, frame);
+    }
 
-        frame = next_frame;
+    chSysLock();
+    for (struct can_tx_frame_s* frame = *frame_list; frame != NULL; frame = frame->next) {
+        can_tx_deadline_heap_push_I(&instance->deadline_heap, frame);
     }
+    can_tx_queue_push_list_I(&instance->tx_queue, *frame_list);
+    can_try_enqueue_waiting_frame_I(instance);
+    can_arm_expire_timer_I(instance);
+    chSchRescheduleS();
+    chSysUnlock();
 
     *frame_list = NULL;
+}
 
-    can_try_enqueue_waiting_frame(instance);
-    can_reschedule_expire_timer(instance);
+void can_enqueue_tx_frames(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, struct pubsub_topic_s* completion_topic) {
+    can_enqueue_tx_frame_list(instance, frame_list, tx_timeout, completion_topic, NULL, NULL);
+}
+
+void can_enqueue_tx_transfer(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, can_tx_completion_cb_t completion_cb, void* completion_ctx) {
+    can_enqueue_tx_frame_list(instance, frame_list, tx_timeout, NULL, completion_cb, completion_ctx);
 }
 
 void can_free_tx_frames(struct can_instance_s* instance, struct can_tx_frame_s** frame_list) {
@@ -301,10 +386,20 @@ struct can_instance_s* can_driver_register(uint8_t can_idx, void* driver_ctx, co
         return NULL;
     }
 
+    struct can_tx_frame_s** deadline_heap_mem = chCoreAlloc(CAN_TX_QUEUE_LEN*sizeof(struct can_tx_frame_s*));
+
+    if (!deadline_heap_mem) {
+        return NULL;
+    }
+
     if (num_tx_mailboxes > MAX_NUM_TX_MAILBOXES) {
         num_tx_mailboxes = MAX_NUM_TX_MAILBOXES;
     }
 
+    if (num_rx_mailboxes > MAX_NUM_RX_MAILBOXES) {
+        num_rx_mailboxes = MAX_NUM_RX_MAILBOXES;
+    }
+
     instance->idx = can_idx;
 
     instance->started = false;
@@ -316,22 +411,37 @@ struct can_instance_s* can_driver_register(uint8_t can_idx, void* driver_ctx, co
     instance->driver_ctx = driver_ctx;
     instance->driver_iface = driver_iface;
 
+    chMtxObjectInit(&instance->filter_mutex);
+    instance->filter_list_head = NULL;
+    instance->filters_committed = false;
+
     for (uint8_t i=0; i<MAX_NUM_TX_MAILBOXES; i++) {
         instance->tx_mailbox[i].state = CAN_TX_MAILBOX_EMPTY;
     }
     instance->num_tx_mailboxes = num_tx_mailboxes;
     
+    instance->num_rx_mailboxes = num_rx_mailboxes;
+    memset(instance->rx_overruns, 0, sizeof(instance->rx_overruns));
+
     chPoolObjectInit(&instance->frame_pool, sizeof(struct can_tx_frame_s), NULL);
     chPoolLoadArray(&instance->frame_pool, tx_queue_mem, CAN_TX_QUEUE_LEN);
 
-    can_tx_queue_init(&instance->tx_queue);
+    can_tx_queue_init(&instance->tx_queue, CAN_TX_QUEUE_TYPE);
 
     pubsub_init_topic(&instance->rx_topic, NULL); // TODO specific/configurable topic group
-    worker_thread_add_publisher_task(&WT_TRX, &instance->rx_publisher_task, sizeof(struct can_rx_frame_s), num_rx_mailboxes*rx_fifo_depth);
 
-    worker_thread_add_publisher_task(&WT_TRX, &instance->tx_publisher_task, sizeof(struct can_transmit_completion_msg_s), num_tx_mailboxes);
+    // The channels take the place of a mailbox and memory pool in the interrupt path, but nothing consumes their slots in
+    // place. The subscribers of rx_topic and of the completion topics run on their own worker threads, so WT_TRX copies each
+    // slot into its topic and received frames are still copied twice. Transmit completions can avoid the copy with
+    // can_enqueue_tx_transfer's completion callback.
+    worker_thread_add_channel_task(&WT_TRX, &instance->rx_channel_task, sizeof(struct can_rx_frame_s), num_rx_mailboxes*rx_fifo_depth, NULL, NULL);
+
+    worker_thread_add_channel_task(&WT_TRX, &instance->tx_channel_task, sizeof(struct can_transmit_completion_msg_s), num_tx_mailboxes, NULL, NULL);
 
+    can_tx_deadline_heap_init(&instance->deadline_heap, deadline_heap_mem, CAN_TX_QUEUE_LEN);
     worker_thread_add_timer_task(&WT_EXPIRE, &instance->expire_timer_task, can_expire_handler, instance, TIME_INFINITE, false);
+    instance->expire_timer_armed = false;
+    memset(instance->expired_tx_frames, 0, sizeof(instance->expired_tx_frames));
 
     LINKED_LIST_APPEND(struct can_instance_s, can_instance_list_head, instance);
 
@@ -379,36 +489,30 @@ static void can_try_enqueue_waiting_frame(struct can_instance_s* instance) {
     chSysUnlock();
 }
 
-static void can_reschedule_expire_timer_I(struct can_instance_s* instance) {
+// - Arms the expire timer for the earliest deadline, unless it is already armed for that or an earlier one. Frames leaving
+//   the heap early, on completion, are not followed, so the timer may go off with nothing to expire. The handler then
+//   re-arms it for whatever is now earliest.
+static void can_arm_expire_timer_I(struct can_instance_s* instance) {
     chDbgCheckClassI();
 
-    // Find frame that expires soonest in mailboxes and queue, schedule expire handler for that time
-    systime_t t_now = chVTGetSystemTimeX();
-    systime_t min_ticks_to_expire = TIME_INFINITE;
-
-    for (uint8_t i=0; i < instance->num_tx_mailboxes; i++) {
-        if (instance->tx_mailbox[i].state == CAN_TX_MAILBOX_PENDING) {
-            systime_t ticks_to_expire = can_tx_frame_time_until_expire_X(instance->tx_mailbox[i].frame, t_now);
-            if (ticks_to_expire < min_ticks_to_expire) {
-                min_ticks_to_expire = ticks_to_expire;
-            }
-        }
+    struct can_tx_frame_s* frame = can_tx_deadline_heap_peek_I(&instance->deadline_heap);
+    if (!frame) {
+        return;
     }
 
-    struct can_tx_frame_s* frame = NULL;
-    while (can_tx_queue_iterate_I(&instance->tx_queue, &frame)) {
-        systime_t ticks_to_expire = can_tx_frame_time_until_expire_X(frame, t_now);
-        if (ticks_to_expire < min_ticks_to_expire) {
-            min_ticks_to_expire = ticks_to_expire;
-        }
+    systime_t deadline = frame->creation_systime + frame->tx_timeout;
+    if (instance->expire_timer_armed && (systime_t)(deadline - instance->expire_timer_deadline) < (systime_t)(TIME_INFINITE/2)) {
+        return;
     }
 
-    worker_thread_timer_task_reschedule_I(&WT_EXPIRE, &instance->expire_timer_task, min_ticks_to_expire);
+    instance->expire_timer_armed = true;
+    instance->expire_timer_deadline = deadline;
+    worker_thread_timer_task_reschedule_I(&WT_EXPIRE, &instance->expire_timer_task, can_tx_frame_time_until_expire_X(frame, chVTGetSystemTimeX()));
 }
 
-static void can_reschedule_expire_timer(struct can_instance_s* instance) {
+static void can_arm_expire_timer(struct can_instance_s* instance) {
     chSysLock();
-    can_reschedule_expire_timer_I(instance);
+    can_arm_expire_timer_I(instance);
     chSchRescheduleS();
     chSysUnlock();
 }
@@ -417,16 +521,28 @@ static void can_tx_frame_completed_I(struct can_instance_s* instance, struct can
     chDbgCheckClassI();
 
     if (frame->completion_topic) {
-        struct can_transmit_completion_msg_s msg = { success, completion_systime };
-        worker_thread_publisher_task_publish_I(&instance->tx_publisher_task, frame->completion_topic, sizeof(struct can_transmit_completion_msg_s), pubsub_copy_writer_func, &msg);
+        struct can_transmit_completion_msg_s msg = { completion_systime, success };
+        worker_thread_channel_task_publish_I(&instance->tx_channel_task, frame->completion_topic, sizeof(struct can_transmit_completion_msg_s), pubsub_copy_writer_func, &msg);
+    }
+    if (frame->completion_cb) {
+        frame->completion_cb(success, completion_systime, frame->completion_ctx);
     }
     chPoolFreeI(&instance->frame_pool, frame);
 }
 
 static void can_tx_frame_completed(struct can_instance_s* instance, struct can_tx_frame_s* frame, bool success, systime_t completion_systime) {
     if (frame->completion_topic) {
-        struct can_transmit_completion_msg_s msg = { success, completion_systime };
-        pubsub_publish_message(frame->completion_topic, sizeof(struct can_transmit_completion_msg_s), pubsub_copy_writer_func, &msg);
+        struct can_transmit_completion_msg_s* msg = pubsub_publish_begin(frame->completion_topic, sizeof(struct can_transmit_completion_msg_s));
+        if (msg) {
+            msg->completion_systime = completion_systime;
+            msg->transmit_success = success;
+            pubsub_publish_commit(msg);
+        }
+    }
+    if (frame->completion_cb) {
+        chSysLock();
+        frame->completion_cb(success, completion_systime, frame->completion_ctx);
+        chSysUnlock();
     }
     chPoolFree(&instance->frame_pool, frame);
 }
@@ -434,32 +550,76 @@ static void can_tx_frame_completed(struct can_instance_s* instance, struct can_t
 static void can_expire_handler(struct worker_thread_timer_task_s* task) {
     struct can_instance_s* instance = worker_thread_task_get_user_context(task);
 
-    // Abort expired mailboxes
-    for (uint8_t i=0; i < instance->num_tx_mailboxes; i++) {
+    chSysLock();
+    instance->expire_timer_armed = false;
+    chSysUnlock();
+
+    // Expire frames in deadline order, taking the lock once per frame
+    while (true) {
         chSysLock();
-        if (instance->tx_mailbox[i].state == CAN_TX_MAILBOX_PENDING && can_tx_frame_expired_X(instance->tx_mailbox[i].frame)) {
-            if (instance->driver_iface->abort_tx_mailbox_I(instance->driver_ctx, i)) {
-                instance->tx_mailbox[i].state = CAN_TX_MAILBOX_ABORTING;
+        struct can_tx_frame_s* frame = can_tx_deadline_heap_peek_I(&instance->deadline_heap);
+        if (!frame || !can_tx_frame_expired_X(frame)) {
+            chSysUnlock();
+            break;
+        }
+
+        can_tx_deadline_heap_remove_I(&instance->deadline_heap, frame);
+
+        // Frames loaded into a mailbox are aborted there, and completed by the driver. They only count as expired if the abort
+        // beats the transmission.
+        bool in_mailbox = false;
+        for (uint8_t i=0; i < instance->num_tx_mailboxes; i++) {
+            if (instance->tx_mailbox[i].state != CAN_TX_MAILBOX_EMPTY && instance->tx_mailbox[i].frame == frame) {
+                if (instance->tx_mailbox[i].state == CAN_TX_MAILBOX_PENDING && instance->driver_iface->abort_tx_mailbox_I(instance->driver_ctx, i)) {
+                    instance->tx_mailbox[i].state = CAN_TX_MAILBOX_ABORTING;
+                }
+                in_mailbox = true;
+                break;
             }
         }
+
+        if (in_mailbox) {
+            chSysUnlock();
+            continue;
+        }
+
+        can_tx_queue_remove_I(&instance->tx_queue, frame);
+        instance->expired_tx_frames[can_get_frame_priority_class_X(&frame->content)]++;
         chSysUnlock();
-    }
 
-    // Abort expired queue items
-    struct can_tx_frame_s* frame;
-    while ((frame = can_tx_queue_pop_expired(&instance->tx_queue)) != NULL) {
         can_tx_frame_completed(instance, frame, false, chVTGetSystemTimeX());
     }
 
     can_try_enqueue_waiting_frame(instance);
 
-    can_reschedule_expire_timer(instance);
+    can_arm_expire_timer(instance);
+}
+
+uint32_t can_get_expired_tx_frame_count(struct can_instance_s* instance, uint8_t priority_class) {
+    if (!instance || priority_class >= CAN_NUM_PRIORITY_CLASSES) {
+        return 0;
+    }
+
+    return instance->expired_tx_frames[priority_class];
+}
+
+uint32_t can_get_rx_overrun_count(struct can_instance_s* instance, uint8_t mb_idx) {
+    if (!instance || mb_idx >= instance->num_rx_mailboxes) {
+        return 0;
+    }
+
+    return instance->rx_overruns[mb_idx];
 }
 
 void can_driver_tx_request_complete_I(struct can_instance_s* instance, uint8_t mb_idx, bool transmit_success, systime_t completion_systime) {
     chDbgCheckClassI();
     chDbgCheck(instance->tx_mailbox[mb_idx].state == CAN_TX_MAILBOX_PENDING || instance->tx_mailbox[mb_idx].state == CAN_TX_MAILBOX_ABORTING);
 
+    if (!transmit_success && instance->tx_mailbox[mb_idx].state == CAN_TX_MAILBOX_ABORTING) {
+        instance->expired_tx_frames[can_get_frame_priority_class_X(&instance->tx_mailbox[mb_idx].frame->content)]++;
+    }
+
+    can_tx_deadline_heap_remove_I(&instance->deadline_heap, instance->tx_mailbox[mb_idx].frame);
     can_tx_frame_completed_I(instance, instance->tx_mailbox[mb_idx].frame, transmit_success, completion_systime);
     instance->tx_mailbox[mb_idx].state = CAN_TX_MAILBOX_EMPTY;
 
@@ -489,6 +649,17 @@ void can_driver_rx_frame_received_I(struct can_instance_s* instance, uint8_t mb_
     chDbgCheckClassI();
 
     struct can_fill_rx_frame_params_s can_fill_rx_frame_params = {rx_systime, frame};
-    worker_thread_publisher_task_publish_I(&instance->rx_publisher_task, &instance->rx_topic, sizeof(struct can_rx_frame_s), can_fill_rx_frame_I, &can_fill_rx_frame_params);
-    instance->baudrate_confirmed = true;
+    worker_thread_channel_task_publish_I(&instance->rx_channel_task, &instance->rx_topic, sizeof(struct can_rx_frame_s), can_fill_rx_frame_I, &can_fill_rx_frame_params);
+    if (!instance->baudrate_confirmed) {
+        instance->baudrate_confirmed = true;
+        can_enable_filters_I(instance);
+    }
+}
+
+void can_driver_rx_overrun_I(struct can_instance_s* instance, uint8_t mb_idx) {
+    chDbgCheckClassI();
+
+    if (mb_idx < instance->num_rx_mailboxes) {
+        instance->rx_overruns[mb_idx]++;
+    }
 }
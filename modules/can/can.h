@@ -8,6 +8,22 @@
 
 struct can_instance_s;
 
+// - Priority classes are the top 5 bits of the arbitration ID, 0 being the highest priority. For UAVCAN frames this is the
+//   transfer priority.
+#define CAN_NUM_PRIORITY_CLASSES 32
+
+// - Acceptance filter in frame ID space: a data frame is accepted if its IDE matches and (frame ID & mask) == (id & mask).
+// - Until can_commit_filters is first called, every frame is accepted. After that, only frames matching at least one
+//   filter are, and an empty filter list accepts nothing.
+// - The filter is owned by the caller and linked into the instance by can_add_filter. It must not be modified until it
+//   has been removed again.
+struct can_filter_s {
+    bool IDE;
+    uint32_t id;
+    uint32_t mask;
+    struct can_filter_s* next;
+};
+
 struct can_transmit_completion_msg_s {
     systime_t completion_systime;
     bool transmit_success;
@@ -31,11 +47,22 @@ void can_set_baudrate(struct can_instance_s* instance, uint32_t baudrate);
 uint32_t can_get_baudrate(struct can_instance_s* instance);
 bool can_get_baudrate_confirmed(struct can_instance_s* instance);
 
+void can_add_filter(struct can_instance_s* instance, struct can_filter_s* filter);
+void can_remove_filter(struct can_instance_s* instance, struct can_filter_s* filter);
+void can_commit_filters(struct can_instance_s* instance);
+
 struct can_tx_frame_s* can_allocate_tx_frame_and_append_I(struct can_instance_s* instance, struct can_tx_frame_s** frame_list);
 struct can_tx_frame_s* can_allocate_tx_frame_and_append(struct can_instance_s* instance, struct can_tx_frame_s** frame_list);
 struct can_tx_frame_s* can_allocate_tx_frames(struct can_instance_s* instance, size_t num_frames);
 void can_enqueue_tx_frames(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, struct pubsub_topic_s* completion_topic);
+void can_enqueue_tx_transfer(struct can_instance_s* instance, struct can_tx_frame_s** frame_list, systime_t tx_timeout, can_tx_completion_cb_t completion_cb, void* completion_ctx);
 void can_free_tx_frames(struct can_instance_s* instance, struct can_tx_frame_s** frame_list);
 
+// - Frames of the priority class dropped because their TX timeout elapsed before they were sent. A frame whose abort comes too
+//   late and is sent anyway is not counted.
+uint32_t can_get_expired_tx_frame_count(struct can_instance_s* instance, uint8_t priority_class);
+// - Overruns of the driver's receive mailbox mb_idx, i.e. frames dropped because it was full. See can_driver_rx_overrun_I.
+uint32_t can_get_rx_overrun_count(struct can_instance_s* instance, uint8_t mb_idx);
+
 bool can_send_I(struct can_instance_s* instance, struct can_frame_s* frame, systime_t tx_timeout, struct pubsub_topic_s* completion_topic);
 bool can_send(struct can_instance_s* instance, struct can_frame_s* frame, systime_t tx_timeout, struct pubsub_topic_s* completion_topic);
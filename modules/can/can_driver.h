@@ -1,6 +1,8 @@
 #pragma once
 #include "can_frame_types.h"
 
+struct can_filter_s;
+
 typedef void (*driver_start_t)(void* ctx, bool silent, bool auto_retransmit, uint32_t baudrate);
 typedef void (*driver_stop_t)(void* ctx);
 
@@ -8,14 +10,25 @@ typedef bool (*driver_mailbox_abort_t)(void* ctx, uint8_t mb_idx);
 typedef bool (*driver_load_tx_mailbox_t)(void* ctx, uint8_t mb_idx, struct can_frame_s* frame);
 typedef bool (*driver_pop_rx_frame_t)(void* ctx, uint8_t mb_idx, struct can_frame_s* frame);
 typedef bool (*driver_rx_frame_available_t)(void* ctx, uint8_t mb_idx);
+typedef void (*driver_set_filters_t)(void* ctx, const struct can_filter_s* filter_list_head);
+typedef void (*driver_enable_filters_t)(void* ctx);
 
 struct can_driver_iface_s {
     driver_start_t start;
     driver_stop_t stop;
     driver_mailbox_abort_t abort_tx_mailbox_I;
     driver_load_tx_mailbox_t load_tx_mailbox_I;
+    // - Optional, NULL if the hardware has no acceptance filters.
+    // - set_filters is called from thread context with the complete filter list whenever it is committed. It may take
+    //   its time fitting the list to the hardware, but must not apply it until enable_filters_I is called.
+    // - enable_filters_I applies the last filter list set. start disables the filters again.
+    driver_set_filters_t set_filters;
+    driver_enable_filters_t enable_filters_I;
 };
 
 struct can_instance_s* can_driver_register(uint8_t can_idx, void* driver_ctx, const struct can_driver_iface_s* driver_iface, uint8_t num_tx_mailboxes, uint8_t num_rx_mailboxes, uint8_t rx_fifo_depth);
 void can_driver_tx_request_complete_I(struct can_instance_s* instance, uint8_t mb_idx, bool transmit_success, systime_t completion_systime);
 void can_driver_rx_frame_received_I(struct can_instance_s* instance, uint8_t mb_idx, systime_t rx_systime, struct can_frame_s* frame);
+// - Called once for each frame the hardware dropped because receive mailbox mb_idx was full. Hardware that only flags
+//   that an overrun happened calls it once per flag.
+void can_driver_rx_overrun_I(struct can_instance_s* instance, uint8_t mb_idx);
@@ -26,10 +26,18 @@ struct can_rx_frame_s {
     systime_t rx_systime;
 };
 
+// - Called when the last frame of a transfer has completed, with that frame's result. It runs in I-class context, from the
+//   CAN interrupt or, for frames that expired in the queue, from the expire worker thread with the system locked.
+typedef void (*can_tx_completion_cb_t)(bool transmit_success, systime_t completion_systime, void* ctx);
+
 struct can_tx_frame_s {
     struct can_frame_s content;
     systime_t creation_systime;
     systime_t tx_timeout;
     struct pubsub_topic_s* completion_topic;
+    can_tx_completion_cb_t completion_cb;
+    void* completion_ctx;
     struct can_tx_frame_s* next;
+    struct can_tx_frame_s* prev; // Only maintained by the bucketed TX queue
+    uint16_t deadline_heap_idx;
 };
@@ -17,6 +17,23 @@ systime_t can_tx_frame_time_until_expire_X(struct can_tx_frame_s* frame, systime
     return frame->tx_timeout - time_elapsed;
 }
 
+// - Deadlines are compared relative to each other, so this holds across systime wraparound as long as they are less than
+//   half the systime range apart.
+bool can_tx_frame_deadline_before_X(const struct can_tx_frame_s* a, const struct can_tx_frame_s* b) {
+    systime_t a_deadline = a->creation_systime + a->tx_timeout;
+    systime_t b_deadline = b->creation_systime + b->tx_timeout;
+    return (systime_t)(b_deadline - a_deadline - 1) < (systime_t)(TIME_INFINITE/2);
+}
+
+// - The top 5 bits of the arbitration ID, 0 being the highest priority. For UAVCAN frames this is the transfer priority.
+uint8_t can_get_frame_priority_class_X(const struct can_frame_s* frame) {
+    if (frame->IDE) {
+        return frame->EID >> 24;
+    } else {
+        return frame->SID >> 6;
+    }
+}
+
 can_frame_priority_t can_get_frame_priority_X(const struct can_frame_s* frame) {
     can_frame_priority_t ret = 0;
 
@@ -0,0 +1,105 @@
+#include "can_tx_deadline_heap.h"
+#include "can_helpers.h"
+
+#include <ch.h>
+
+static void can_tx_deadline_heap_set(struct can_tx_deadline_heap_s* heap, uint16_t idx, struct can_tx_frame_s* frame);
+static void can_tx_deadline_heap_sift_up(struct can_tx_deadline_heap_s* heap, uint16_t idx);
+static void can_tx_deadline_heap_sift_down(struct can_tx_deadline_heap_s* heap, uint16_t idx);
+
+void can_tx_deadline_heap_init(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s** frames_mem, uint16_t capacity) {
+    heap->frames = frames_mem;
+    heap->capacity = capacity;
+    heap->size = 0;
+}
+
+void can_tx_deadline_heap_push_I(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s* frame) {
+    chDbgCheckClassI();
+
+    frame->deadline_heap_idx = CAN_TX_DEADLINE_HEAP_IDX_NONE;
+    if (frame->tx_timeout == TIME_INFINITE) {
+        return;
+    }
+
+    chDbgCheck(heap->size < heap->capacity);
+    if (heap->size >= heap->capacity) {
+        return;
+    }
+
+    can_tx_deadline_heap_set(heap, heap->size, frame);
+    heap->size++;
+    can_tx_deadline_heap_sift_up(heap, frame->deadline_heap_idx);
+}
+
+void can_tx_deadline_heap_remove_I(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s* frame) {
+    chDbgCheckClassI();
+
+    uint16_t idx = frame->deadline_heap_idx;
+    if (idx >= heap->size || heap->frames[idx] != frame) {
+        return;
+    }
+
+    frame->deadline_heap_idx = CAN_TX_DEADLINE_HEAP_IDX_NONE;
+    heap->size--;
+    if (idx == heap->size) {
+        return;
+    }
+
+    // Fill the hole with the last frame, which may belong above or below it
+    struct can_tx_frame_s* moved_frame = heap->frames[heap->size];
+    can_tx_deadline_heap_set(heap, idx, moved_frame);
+    can_tx_deadline_heap_sift_up(heap, idx);
+    can_tx_deadline_heap_sift_down(heap, moved_frame->deadline_heap_idx);
+}
+
+struct can_tx_frame_s* can_tx_deadline_heap_peek_I(struct can_tx_deadline_heap_s* heap) {
+    chDbgCheckClassI();
+
+    return heap->size > 0 ? heap->frames[0] : NULL;
+}
+
+static void can_tx_deadline_heap_set(struct can_tx_deadline_heap_s* heap, uint16_t idx, struct can_tx_frame_s* frame) {
+    heap->frames[idx] = frame;
+    frame->deadline_heap_idx = idx;
+}
+
+static bool can_tx_deadline_heap_less(struct can_tx_deadline_heap_s* heap, uint16_t a, uint16_t b) {
+    return can_tx_frame_deadline_before_X(heap->frames[a], heap->frames[b]);
+}
+
+static void can_tx_deadline_heap_swap(struct can_tx_deadline_heap_s* heap, uint16_t a, uint16_t b) {
+    struct can_tx_frame_s* frame_a = heap->frames[a];
+    can_tx_deadline_heap_set(heap, a, heap->frames[b]);
+    can_tx_deadline_heap_set(heap, b, frame_a);
+}
+
+static void can_tx_deadline_heap_sift_up(struct can_tx_deadline_heap_s* heap, uint16_t idx) {
+    while (idx > 0) {
+        uint16_t parent_idx = (idx-1)/2;
+        if (!can_tx_deadline_heap_less(heap, idx, parent_idx)) {
+            break;
+        }
+        can_tx_deadline_heap_swap(heap, idx, parent_idx);
+        idx = parent_idx;
+    }
+}
+
+static void can_tx_deadline_heap_sift_down(struct can_tx_deadline_heap_s* heap, uint16_t idx) {
+    while (true) {
+        uint16_t min_idx = idx;
+        uint16_t child_idx = 2*idx+1;
+
+        if (child_idx < heap->size && can_tx_deadline_heap_less(heap, child_idx, min_idx)) {
+            min_idx = child_idx;
+        }
+        if (child_idx+1 < heap->size && can_tx_deadline_heap_less(heap, child_idx+1, min_idx)) {
+            min_idx = child_idx+1;
+        }
+        if (min_idx == idx) {
+            break;
+        }
+
+        can_tx_deadline_heap_swap(heap, idx, min_idx);
+        idx = min_idx;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "can_frame_types.h"
+
+// - Binary min-heap of the TX frames that can expire, queued or loaded into a mailbox, ordered by expiry deadline. Frames
+//   with an infinite timeout are never added.
+// - Each frame records its own position in the heap, so pushing and removing are O(log n) and peeking at the frame that
+//   expires first is O(1).
+
+#define CAN_TX_DEADLINE_HEAP_IDX_NONE 0xFFFF
+
+struct can_tx_deadline_heap_s {
+    struct can_tx_frame_s** frames;
+    uint16_t capacity;
+    uint16_t size;
+};
+
+void can_tx_deadline_heap_init(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s** frames_mem, uint16_t capacity);
+
+void can_tx_deadline_heap_push_I(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s* frame);
+void can_tx_deadline_heap_remove_I(struct can_tx_deadline_heap_s* heap, struct can_tx_frame_s* frame);
+struct can_tx_frame_s* can_tx_deadline_heap_peek_I(struct can_tx_deadline_heap_s* heap);
@@ -9,8 +9,17 @@
 static bool can_tx_queue_frame_exists_in_queue(struct can_tx_queue_s* instance, struct can_tx_frame_s* check_frame);
 #endif
 
-bool can_tx_queue_init(struct can_tx_queue_s* instance) {
+static uint8_t can_tx_queue_get_bucket_idx(struct can_tx_frame_s* frame);
+static int8_t can_tx_queue_get_highest_bucket_idx(uint32_t bucket_mask);
+static void can_tx_queue_bucket_push_back(struct can_tx_queue_s* instance, struct can_tx_frame_s* first_frame, struct can_tx_frame_s* last_frame);
+static void can_tx_queue_bucket_push_front(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
+static void can_tx_queue_bucket_remove(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
+
+bool can_tx_queue_init(struct can_tx_queue_s* instance, enum can_tx_queue_type_t type) {
+    instance->type = type;
     instance->head = NULL;
+    instance->bucket_mask = 0;
+    memset(instance->buckets, 0, sizeof(instance->buckets));
     return true;
 }
 
@@ -21,6 +30,11 @@ void can_tx_queue_push_I(struct can_tx_queue_s* instance, struct can_tx_frame_s*
     chDbgCheck(!can_tx_queue_frame_exists_in_queue(instance, push_frame));
 #endif
 
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        can_tx_queue_bucket_push_back(instance, push_frame, push_frame);
+        return;
+    }
+
     can_frame_priority_t push_frame_prio = can_get_tx_frame_priority_X(push_frame);
 
     struct can_tx_frame_s** insert_ptr = &instance->head;
@@ -38,6 +52,40 @@ void can_tx_queue_push(struct can_tx_queue_s* instance, struct can_tx_frame_s* p
     chSysUnlock();
 }
 
+void can_tx_queue_push_list_I(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame_list) {
+    chDbgCheckClassI();
+
+    while (frame_list != NULL) {
+        struct can_tx_frame_s* first_frame = frame_list;
+        struct can_tx_frame_s* last_frame = frame_list;
+        can_frame_priority_t run_prio = can_get_tx_frame_priority_X(first_frame);
+
+#if CH_DBG_ENABLE_CHECKS
+        chDbgCheck(!can_tx_queue_frame_exists_in_queue(instance, first_frame));
+#endif
+        while (last_frame->next != NULL && can_get_tx_frame_priority_X(last_frame->next) == run_prio) {
+            last_frame = last_frame->next;
+#if CH_DBG_ENABLE_CHECKS
+            chDbgCheck(!can_tx_queue_frame_exists_in_queue(instance, last_frame));
+#endif
+        }
+        frame_list = last_frame->next;
+
+        if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+            can_tx_queue_bucket_push_back(instance, first_frame, last_frame);
+            continue;
+        }
+
+        struct can_tx_frame_s** insert_ptr = &instance->head;
+        while(*insert_ptr != NULL && run_prio <= can_get_tx_frame_priority_X(*insert_ptr)) {
+            insert_ptr = &(*insert_ptr)->next;
+        }
+
+        last_frame->next = *insert_ptr;
+        *insert_ptr = first_frame;
+    }
+}
+
 void can_tx_queue_push_ahead_I(struct can_tx_queue_s* instance, struct can_tx_frame_s* push_frame) {
     chDbgCheckClassI();
     
@@ -45,6 +93,11 @@ void can_tx_queue_push_ahead_I(struct can_tx_queue_s* instance, struct can_tx_fr
     chDbgCheck(!can_tx_queue_frame_exists_in_queue(instance, push_frame));
 #endif
 
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        can_tx_queue_bucket_push_front(instance, push_frame);
+        return;
+    }
+
     struct can_tx_frame_s** insert_ptr = &instance->head;
 
     can_frame_priority_t push_frame_prio = can_get_tx_frame_priority_X(push_frame);
@@ -70,6 +123,22 @@ bool can_tx_queue_iterate_I(struct can_tx_queue_s* instance, struct can_tx_frame
         return false;
     }
 
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        // Walk each bucket in turn, from the highest priority class down
+        uint32_t remaining_bucket_mask = instance->bucket_mask;
+        if (*frame_ptr != NULL) {
+            if ((*frame_ptr)->next) {
+                *frame_ptr = (*frame_ptr)->next;
+                return true;
+            }
+            remaining_bucket_mask &= (1UL << can_tx_queue_get_bucket_idx(*frame_ptr)) - 1;
+        }
+
+        int8_t bucket_idx = can_tx_queue_get_highest_bucket_idx(remaining_bucket_mask);
+        *frame_ptr = bucket_idx >= 0 ? instance->buckets[bucket_idx].head : NULL;
+        return *frame_ptr != NULL;
+    }
+
     if (*frame_ptr == NULL) {
         *frame_ptr = instance->head;
     } else {
@@ -85,12 +154,22 @@ void can_tx_queue_remove_I(struct can_tx_queue_s* instance, struct can_tx_frame_
     chDbgCheck(can_tx_queue_frame_exists_in_queue(instance, frame));
 #endif
 
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        can_tx_queue_bucket_remove(instance, frame);
+        return;
+    }
+
     LINKED_LIST_REMOVE(struct can_tx_frame_s, instance->head, frame);
 }
 
 struct can_tx_frame_s* can_tx_queue_peek_I(struct can_tx_queue_s* instance) {
     chDbgCheckClassI();
     
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        int8_t bucket_idx = can_tx_queue_get_highest_bucket_idx(instance->bucket_mask);
+        return bucket_idx >= 0 ? instance->buckets[bucket_idx].head : NULL;
+    }
+
     return instance->head;
 }
 
@@ -104,6 +183,14 @@ struct can_tx_frame_s* can_tx_queue_peek(struct can_tx_queue_s* instance) {
 void can_tx_queue_pop_I(struct can_tx_queue_s* instance) {
     chDbgCheckClassI();
 
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        struct can_tx_frame_s* frame = can_tx_queue_peek_I(instance);
+        if (frame) {
+            can_tx_queue_bucket_remove(instance, frame);
+        }
+        return;
+    }
+
     if (instance->head) {
         instance->head = instance->head->next;
     }
@@ -118,6 +205,17 @@ void can_tx_queue_pop(struct can_tx_queue_s* instance) {
 struct can_tx_frame_s* can_tx_queue_pop_expired_I(struct can_tx_queue_s* instance) {
     chDbgCheckClassI();
     
+    if (instance->type == CAN_TX_QUEUE_BUCKETED) {
+        struct can_tx_frame_s* frame = NULL;
+        while (can_tx_queue_iterate_I(instance, &frame)) {
+            if (can_tx_frame_expired_X(frame)) {
+                can_tx_queue_bucket_remove(instance, frame);
+                return frame;
+            }
+        }
+        return NULL;
+    }
+
     struct can_tx_frame_s* ret = NULL;
     struct can_tx_frame_s** expired_ptr = &instance->head;
     while (*expired_ptr && !can_tx_frame_expired_X(*expired_ptr)) {
@@ -140,6 +238,80 @@ struct can_tx_frame_s* can_tx_queue_pop_expired(struct can_tx_queue_s* instance)
     return ret;
 }
 
+// The priority value is the inverted arbitration field, so its top bits are the inverted top bits of the ID and a higher
+// bucket index is a higher priority
+static uint8_t can_tx_queue_get_bucket_idx(struct can_tx_frame_s* frame) {
+    return can_get_tx_frame_priority_X(frame) >> 27;
+}
+
+static int8_t can_tx_queue_get_highest_bucket_idx(uint32_t bucket_mask) {
+    if (bucket_mask == 0) {
+        return -1;
+    }
+    return 31-__builtin_clz(bucket_mask);
+}
+
+// - Appends the frames from first_frame to last_frame, which are linked through next and all in the same bucket
+static void can_tx_queue_bucket_push_back(struct can_tx_queue_s* instance, struct can_tx_frame_s* first_frame, struct can_tx_frame_s* last_frame) {
+    uint8_t bucket_idx = can_tx_queue_get_bucket_idx(first_frame);
+    struct can_tx_queue_bucket_s* bucket = &instance->buckets[bucket_idx];
+
+    for (struct can_tx_frame_s* frame = first_frame; frame != last_frame; frame = frame->next) {
+        frame->next->prev = frame;
+    }
+
+    last_frame->next = NULL;
+    first_frame->prev = bucket->tail;
+    if (bucket->tail) {
+        bucket->tail->next = first_frame;
+    } else {
+        bucket->head = first_frame;
+    }
+    bucket->tail = last_frame;
+
+    instance->bucket_mask |= 1UL << bucket_idx;
+}
+
+static void can_tx_queue_bucket_push_front(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame) {
+    uint8_t bucket_idx = can_tx_queue_get_bucket_idx(frame);
+    struct can_tx_queue_bucket_s* bucket = &instance->buckets[bucket_idx];
+
+    frame->prev = NULL;
+    frame->next = bucket->head;
+    if (bucket->head) {
+        bucket->head->prev = frame;
+    } else {
+        bucket->tail = frame;
+    }
+    bucket->head = frame;
+
+    instance->bucket_mask |= 1UL << bucket_idx;
+}
+
+static void can_tx_queue_bucket_remove(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame) {
+    uint8_t bucket_idx = can_tx_queue_get_bucket_idx(frame);
+    struct can_tx_queue_bucket_s* bucket = &instance->buckets[bucket_idx];
+
+    if (frame->prev) {
+        frame->prev->next = frame->next;
+    } else {
+        bucket->head = frame->next;
+    }
+
+    if (frame->next) {
+        frame->next->prev = frame->prev;
+    } else {
+        bucket->tail = frame->prev;
+    }
+
+    frame->next = NULL;
+    frame->prev = NULL;
+
+    if (!bucket->head) {
+        instance->bucket_mask &= ~(1UL << bucket_idx);
+    }
+}
+
 #if CH_DBG_ENABLE_CHECKS
 static bool can_tx_queue_frame_exists_in_queue(struct can_tx_queue_s* instance, struct can_tx_frame_s* check_frame) {
     struct can_tx_frame_s* frame = NULL;
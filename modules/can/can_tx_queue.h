@@ -2,15 +2,41 @@
 
 #include "can_frame_types.h"
 
+// - Frames are kept in priority order, highest first, i.e. in the order they would win arbitration.
+// - CAN_TX_QUEUE_LIST keeps frames in a sorted linked list. Pushing is O(n), popping the highest priority frame is O(1).
+//   Frames of equal priority keep their push order.
+// - CAN_TX_QUEUE_BUCKETED keeps one FIFO per priority class, the top 5 bits of the arbitration ID (the UAVCAN priority
+//   field), plus a bitmask of the classes that are not empty. Pushing, popping and removing are O(1). Within a class, frames
+//   are sent in push order rather than by the rest of their ID.
+enum can_tx_queue_type_t {
+    CAN_TX_QUEUE_LIST,
+    CAN_TX_QUEUE_BUCKETED,
+};
+
+#define CAN_TX_QUEUE_NUM_BUCKETS 32
+
+struct can_tx_queue_bucket_s {
+    struct can_tx_frame_s* head;
+    struct can_tx_frame_s* tail;
+};
+
 struct can_tx_queue_s {
+    enum can_tx_queue_type_t type;
     struct can_tx_frame_s* head;
+    uint32_t bucket_mask;
+    struct can_tx_queue_bucket_s buckets[CAN_TX_QUEUE_NUM_BUCKETS];
 };
 
-bool can_tx_queue_init(struct can_tx_queue_s* instance);
+bool can_tx_queue_init(struct can_tx_queue_s* instance, enum can_tx_queue_type_t type);
 
 void can_tx_queue_push_I(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
 void can_tx_queue_push(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
 
+// - Pushes frames linked through next, in one go. Frames of equal priority keep their order. Each run of consecutive frames
+//   with the same priority, such as all frames of a UAVCAN transfer, is spliced in as a whole, so the list is only searched
+//   once per run.
+void can_tx_queue_push_list_I(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame_list);
+
 void can_tx_queue_push_ahead_I(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
 void can_tx_queue_push_ahead(struct can_tx_queue_s* instance, struct can_tx_frame_s* frame);
 
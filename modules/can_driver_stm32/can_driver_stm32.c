@@ -1,5 +1,8 @@
 #include <common/ctor.h>
+#include <common/helpers.h>
 #include <hal.h>
+#include <string.h>
+#include <modules/can/can.h>
 #include <modules/can/can_driver.h>
 
 #if !defined(CAN1) && defined(CAN)
@@ -19,21 +22,95 @@
 #define NUM_RX_MAILBOXES 2
 #define RX_FIFO_DEPTH 3
 
+#if defined(STM32_CAN_MAX_FILTERS) && STM32_CAN_MAX_FILTERS > 14
+// The banks are shared with CAN2, which this driver does not run, so CAN1 takes all but the last one that CAN2SB must leave
+#define NUM_FILTER_BANKS (STM32_CAN_MAX_FILTERS-1)
+#define FILTER_FMR_CAN2SB ((uint32_t)NUM_FILTER_BANKS << 8)
+#else
+#define NUM_FILTER_BANKS 14
+#define FILTER_FMR_CAN2SB 0
+#endif
+
+// Filter register layout of an exact match on an extended data frame ID: STID, EXID, IDE and RTR all compared
+#define FILTER_EXACT_MASK (CAN_RI0R_STID | CAN_RI0R_EXID | CAN_RI0R_IDE | CAN_RI0R_RTR)
+
+// - Extended frames in the CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES highest priority classes (the top five ID bits, as
+//   UAVCAN uses them) are received through FIFO1 and everything else through FIFO0, so that a burst of low priority
+//   traffic can't overflow the FIFO that control traffic arrives in. 0 receives everything through FIFO0.
+// - The hardware can't combine two banks, so once filters are committed these classes are still accepted whether or not
+//   a filter asks for them. Only an empty filter list shuts them out.
+#ifndef CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES
+#define CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES 8
+#endif
+
+#if CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES > 16 || (CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES & (CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES-1)) != 0
+#error CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES must be 0 or a power of two no greater than 16
+#endif
+
+#if CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES > 0
+// Filter register layout of the priority bits that are all zero in exactly the FIFO1 priority classes
+#define FILTER_FIFO1_PRIORITY_MASK ((0x1FUL & ~(CAN_DRIVER_STM32_FIFO1_PRIORITY_CLASSES-1UL)) << 27)
+#define NUM_FIFO1_PRIORITY_BANKS 1
+#else
+#define NUM_FIFO1_PRIORITY_BANKS 0
+#endif
+
+// The priority bank is bank 0, so that it takes precedence over every other mask mode bank
+#define FILTER_FIFO1_PRIORITY_BANKS ((1UL << NUM_FIFO1_PRIORITY_BANKS) - 1)
+
 static void can_driver_stm32_start(void* ctx, bool silent, bool auto_retransmit, uint32_t baudrate);
 static void can_driver_stm32_stop(void* ctx);
 bool can_driver_stm32_abort_tx_mailbox_I(void* ctx, uint8_t mb_idx);
 bool can_driver_stm32_load_tx_mailbox_I(void* ctx, uint8_t mb_idx, struct can_frame_s* frame);
+static void can_driver_stm32_set_filters(void* ctx, const struct can_filter_s* filter_list_head);
+static void can_driver_stm32_enable_filters_I(void* ctx);
 
 static const struct can_driver_iface_s can_driver_stm32_iface = {
     can_driver_stm32_start,
     can_driver_stm32_stop,
     can_driver_stm32_abort_tx_mailbox_I,
     can_driver_stm32_load_tx_mailbox_I,
+    can_driver_stm32_set_filters,
+    can_driver_stm32_enable_filters_I,
+};
+
+// - A filter in filter register layout, so that extended and standard IDs pack and merge alike.
+struct can_driver_stm32_filter_s {
+    uint32_t id;
+    uint32_t mask;
+};
+
+struct can_driver_stm32_filter_bank_s {
+    uint32_t FR1;
+    uint32_t FR2;
+};
+
+static void can_driver_stm32_load_filter_banks(CAN_TypeDef* can, const struct can_driver_stm32_filter_bank_s* filter_banks, uint8_t num_filter_banks, uint32_t list_mode_banks, uint32_t fifo1_banks);
+
+#if NUM_FIFO1_PRIORITY_BANKS > 0
+static const struct can_driver_stm32_filter_s can_driver_stm32_fifo1_priority_filter = {
+    CAN_RI0R_IDE,
+    FILTER_FIFO1_PRIORITY_MASK | CAN_RI0R_IDE,
+};
+#endif
+
+// Used until the frontend enables the filters
+static const struct can_driver_stm32_filter_bank_s can_driver_stm32_accept_all_filter_banks[] = {
+#if NUM_FIFO1_PRIORITY_BANKS > 0
+    { CAN_RI0R_IDE, FILTER_FIFO1_PRIORITY_MASK | CAN_RI0R_IDE },
+#endif
+    { 0, 0 },
 };
 
 struct can_driver_stm32_instance_s {
     struct can_instance_s* frontend;
     CAN_TypeDef* can;
+
+    struct can_driver_stm32_filter_bank_s filter_banks[NUM_FILTER_BANKS];
+    uint8_t num_filter_banks;
+    uint32_t filter_list_mode_banks;
+    uint32_t filter_fifo1_banks;
+    bool filters_enabled;
 };
 
 static struct can_driver_stm32_instance_s can1_instance;
@@ -49,18 +126,14 @@ static void can_driver_stm32_start(void* ctx, bool silent, bool auto_retransmit,
 
     rccEnableCAN1(FALSE);
 
-    instance->can->FMR = (instance->can->FMR & 0xFFFF0000) | CAN_FMR_FINIT;
-    instance->can->sFilterRegister[0].FR1 = 0;
-    instance->can->sFilterRegister[0].FR2 = 0;
-    instance->can->FM1R = 0;
-    instance->can->FFA1R = 0;
-    instance->can->FS1R = 1;
-    instance->can->FA1R = 1;
+    instance->can->FMR = (instance->can->FMR & 0xFFFF0000) | FILTER_FMR_CAN2SB | CAN_FMR_FINIT;
+    can_driver_stm32_load_filter_banks(instance->can, can_driver_stm32_accept_all_filter_banks, LEN(can_driver_stm32_accept_all_filter_banks), 0, FILTER_FIFO1_PRIORITY_BANKS);
 
-    instance->can->FMR &= ~CAN_FMR_FINIT;
+    instance->filters_enabled = false;
 
     nvicEnableVector(STM32_CAN1_TX_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
     nvicEnableVector(STM32_CAN1_RX0_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+    nvicEnableVector(STM32_CAN1_RX1_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
     nvicEnableVector(STM32_CAN1_SCE_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
 
     instance->can->MCR = CAN_MCR_INRQ;
@@ -118,7 +191,7 @@ static void can_driver_stm32_start(void* ctx, bool silent, bool auto_retransmit,
 
     instance->can->MCR = CAN_MCR_ABOM | CAN_MCR_AWUM | (auto_retransmit?0:CAN_MCR_NART);
 
-    instance->can->IER = CAN_IER_TMEIE | CAN_IER_FMPIE0; // TODO: review reference manual for other interrupt flags needed
+    instance->can->IER = CAN_IER_TMEIE | CAN_IER_FMPIE0 | CAN_IER_FOVIE0 | CAN_IER_FMPIE1 | CAN_IER_FOVIE1; // TODO: review reference manual for other interrupt flags needed
 }
 
 static void can_driver_stm32_stop(void* ctx) {
@@ -129,6 +202,7 @@ static void can_driver_stm32_stop(void* ctx) {
 
     nvicDisableVector(STM32_CAN1_TX_NUMBER);
     nvicDisableVector(STM32_CAN1_RX0_NUMBER);
+    nvicDisableVector(STM32_CAN1_RX1_NUMBER);
     nvicDisableVector(STM32_CAN1_SCE_NUMBER);
 
     rccDisableCAN1(FALSE);
@@ -173,6 +247,189 @@ bool can_driver_stm32_load_tx_mailbox_I(void* ctx, uint8_t mb_idx, struct can_fr
     return true;
 }
 
+static uint32_t can_driver_stm32_filter_popcount(uint32_t x) {
+    return (uint32_t)__builtin_popcount(x);
+}
+
+static bool can_driver_stm32_filter_is_exact(const struct can_driver_stm32_filter_s* filter) {
+    return filter->mask == FILTER_EXACT_MASK;
+}
+
+// - True if everything accepted by b is also accepted by a.
+static bool can_driver_stm32_filter_covers(const struct can_driver_stm32_filter_s* a, const struct can_driver_stm32_filter_s* b) {
+    return (a->mask & ~b->mask) == 0 && ((a->id ^ b->id) & a->mask) == 0;
+}
+
+// - The narrowest single filter that accepts everything a and b do.
+static struct can_driver_stm32_filter_s can_driver_stm32_filter_merge(const struct can_driver_stm32_filter_s* a, const struct can_driver_stm32_filter_s* b) {
+    struct can_driver_stm32_filter_s ret;
+    ret.mask = a->mask & b->mask & ~(a->id ^ b->id);
+    ret.id = a->id & ret.mask;
+    return ret;
+}
+
+// - Exact IDs share list mode banks two to a bank, every other filter takes a mask mode bank of its own.
+static size_t can_driver_stm32_filter_banks_needed(const struct can_driver_stm32_filter_s* filters, size_t num_filters) {
+    size_t num_exact = 0;
+    for (size_t i=0; i<num_filters; i++) {
+        if (can_driver_stm32_filter_is_exact(&filters[i])) {
+            num_exact++;
+        }
+    }
+    return (num_exact+1)/2 + (num_filters-num_exact);
+}
+
+// - Adds a filter to the working set, dropping whichever of it and the existing filters the other covers.
+static void can_driver_stm32_filter_insert(struct can_driver_stm32_filter_s* filters, size_t* num_filters, struct can_driver_stm32_filter_s filter) {
+    size_t i = 0;
+    while (i < *num_filters) {
+        if (can_driver_stm32_filter_covers(&filters[i], &filter)) {
+            return;
+        }
+
+        if (can_driver_stm32_filter_covers(&filter, &filters[i])) {
+            filters[i] = filters[--(*num_filters)];
+        } else {
+            i++;
+        }
+    }
+
+    filters[(*num_filters)++] = filter;
+}
+
+// - Merges the pair of filters whose merge stays narrowest, i.e. keeps the most mask bits.
+static void can_driver_stm32_filter_merge_best_pair(struct can_driver_stm32_filter_s* filters, size_t* num_filters) {
+    size_t best_i = 0;
+    size_t best_j = 1;
+    uint32_t best_mask_bits = 0;
+
+    for (size_t i=0; i<*num_filters; i++) {
+        for (size_t j=i+1; j<*num_filters; j++) {
+            struct can_driver_stm32_filter_s merged = can_driver_stm32_filter_merge(&filters[i], &filters[j]);
+            uint32_t mask_bits = can_driver_stm32_filter_popcount(merged.mask);
+            if (mask_bits > best_mask_bits) {
+                best_i = i;
+                best_j = j;
+                best_mask_bits = mask_bits;
+            }
+        }
+    }
+
+    struct can_driver_stm32_filter_s merged = can_driver_stm32_filter_merge(&filters[best_i], &filters[best_j]);
+
+    // best_j > best_i, so removing best_j first leaves best_i in place
+    filters[best_j] = filters[--(*num_filters)];
+    filters[best_i] = filters[--(*num_filters)];
+    can_driver_stm32_filter_insert(filters, num_filters, merged);
+}
+
+static void can_driver_stm32_set_filters(void* ctx, const struct can_filter_s* filter_list_head) {
+    struct can_driver_stm32_instance_s* instance = ctx;
+
+    // One spare slot, so that a new filter can be inserted before merging brings the set back within the banks
+    struct can_driver_stm32_filter_s filters[2*NUM_FILTER_BANKS+1];
+    size_t num_filters = 0;
+
+    for (const struct can_filter_s* filter = filter_list_head; filter != NULL; filter = filter->next) {
+        struct can_driver_stm32_filter_s reg_filter;
+        if (filter->IDE) {
+            reg_filter.mask = ((filter->mask << 3) & (CAN_RI0R_STID | CAN_RI0R_EXID)) | CAN_RI0R_IDE | CAN_RI0R_RTR;
+            reg_filter.id = ((filter->id << 3) & reg_filter.mask) | CAN_RI0R_IDE;
+        } else {
+            reg_filter.mask = ((filter->mask << 21) & CAN_RI0R_STID) | CAN_RI0R_IDE | CAN_RI0R_RTR;
+            reg_filter.id = (filter->id << 21) & reg_filter.mask;
+        }
+
+#if NUM_FIFO1_PRIORITY_BANKS > 0
+        // The priority bank accepts these already, and being lower numbered, routes them to FIFO1 ahead of any mask mode
+        // bank. Dropping them also keeps exact IDs in the FIFO1 classes out of list mode banks, which would take precedence.
+        if (can_driver_stm32_filter_covers(&can_driver_stm32_fifo1_priority_filter, &reg_filter)) {
+            continue;
+        }
+#endif
+
+        can_driver_stm32_filter_insert(filters, &num_filters, reg_filter);
+
+        while (can_driver_stm32_filter_banks_needed(filters, num_filters) > NUM_FILTER_BANKS-NUM_FIFO1_PRIORITY_BANKS) {
+            can_driver_stm32_filter_merge_best_pair(filters, &num_filters);
+        }
+    }
+
+    struct can_driver_stm32_filter_bank_s filter_banks[NUM_FILTER_BANKS];
+    uint8_t num_filter_banks = 0;
+    uint32_t filter_list_mode_banks = 0;
+    uint32_t filter_fifo1_banks = 0;
+
+#if NUM_FIFO1_PRIORITY_BANKS > 0
+    if (filter_list_head != NULL) {
+        filter_banks[num_filter_banks].FR1 = can_driver_stm32_fifo1_priority_filter.id;
+        filter_banks[num_filter_banks].FR2 = can_driver_stm32_fifo1_priority_filter.mask;
+        num_filter_banks++;
+        filter_fifo1_banks = FILTER_FIFO1_PRIORITY_BANKS;
+    }
+#endif
+
+    bool have_unpaired_exact = false;
+    uint8_t unpaired_exact_bank_idx = 0;
+
+    for (size_t i=0; i<num_filters; i++) {
+        if (!can_driver_stm32_filter_is_exact(&filters[i])) {
+            filter_banks[num_filter_banks].FR1 = filters[i].id;
+            filter_banks[num_filter_banks].FR2 = filters[i].mask;
+            num_filter_banks++;
+        } else if (have_unpaired_exact) {
+            filter_banks[unpaired_exact_bank_idx].FR2 = filters[i].id;
+            have_unpaired_exact = false;
+        } else {
+            // Listed twice until a second exact ID fills the other half of the bank
+            filter_list_mode_banks |= 1UL << num_filter_banks;
+            filter_banks[num_filter_banks].FR1 = filters[i].id;
+            filter_banks[num_filter_banks].FR2 = filters[i].id;
+            unpaired_exact_bank_idx = num_filter_banks;
+            num_filter_banks++;
+            have_unpaired_exact = true;
+        }
+    }
+
+    chSysLock();
+    memcpy(instance->filter_banks, filter_banks, num_filter_banks*sizeof(struct can_driver_stm32_filter_bank_s));
+    instance->num_filter_banks = num_filter_banks;
+    instance->filter_list_mode_banks = filter_list_mode_banks;
+    instance->filter_fifo1_banks = filter_fifo1_banks;
+    if (instance->filters_enabled) {
+        can_driver_stm32_enable_filters_I(instance);
+    }
+    chSysUnlock();
+}
+
+static void can_driver_stm32_enable_filters_I(void* ctx) {
+    struct can_driver_stm32_instance_s* instance = ctx;
+
+    chDbgCheckClassI();
+
+    can_driver_stm32_load_filter_banks(instance->can, instance->filter_banks, instance->num_filter_banks, instance->filter_list_mode_banks, instance->filter_fifo1_banks);
+
+    instance->filters_enabled = true;
+}
+
+// - Banks in fifo1_banks deliver to FIFO1, the rest to FIFO0. All banks are 32 bit.
+static void can_driver_stm32_load_filter_banks(CAN_TypeDef* can, const struct can_driver_stm32_filter_bank_s* filter_banks, uint8_t num_filter_banks, uint32_t list_mode_banks, uint32_t fifo1_banks) {
+    can->FMR |= CAN_FMR_FINIT;
+    can->FA1R = 0;
+
+    for (uint8_t i=0; i<num_filter_banks; i++) {
+        can->sFilterRegister[i].FR1 = filter_banks[i].FR1;
+        can->sFilterRegister[i].FR2 = filter_banks[i].FR2;
+    }
+
+    can->FM1R = list_mode_banks;
+    can->FFA1R = fifo1_banks;
+    can->FS1R = (1UL << NUM_FILTER_BANKS) - 1;
+    can->FA1R = (1UL << num_filter_banks) - 1;
+
+    can->FMR &= ~CAN_FMR_FINIT;
+}
+
 static void can_driver_stm32_retreive_rx_frame_I(struct can_frame_s* frame, CAN_FIFOMailBox_TypeDef* mailbox) {
     frame->data32[0] = mailbox->RDLR;
     frame->data32[1] = mailbox->RDHR;
@@ -186,31 +443,29 @@ static void can_driver_stm32_retreive_rx_frame_I(struct can_frame_s* frame, CAN_
     frame->DLC = mailbox->RDTR & CAN_RDT0R_DLC;
 }
 
-static void stm32_can_rx_handler(struct can_driver_stm32_instance_s* instance) {
+static void stm32_can_rx_handler(struct can_driver_stm32_instance_s* instance, uint8_t fifo_idx) {
     systime_t rx_systime = chVTGetSystemTimeX();
-    while (true) {
-        chSysLockFromISR();
-        if ((instance->can->RF0R & CAN_RF0R_FMP0) == 0) {
-            chSysUnlockFromISR();
-            break;
-        }
-        struct can_frame_s frame;
-        can_driver_stm32_retreive_rx_frame_I(&frame, &instance->can->sFIFOMailBox[0]);
-        can_driver_rx_frame_received_I(instance->frontend, 0, rx_systime, &frame);
-        instance->can->RF0R = CAN_RF0R_RFOM0;
-        chSysUnlockFromISR();
+
+    // RF0R and RF1R share their bit layout
+    volatile uint32_t* RFR = fifo_idx == 0 ? &instance->can->RF0R : &instance->can->RF1R;
+
+    chSysLockFromISR();
+    if ((*RFR & CAN_RF0R_FOVR0) != 0) {
+        *RFR = CAN_RF0R_FOVR0;
+        can_driver_rx_overrun_I(instance->frontend, fifo_idx);
     }
+    chSysUnlockFromISR();
 
     while (true) {
         chSysLockFromISR();
-        if ((instance->can->RF1R & CAN_RF1R_FMP1) == 0) {
+        if ((*RFR & CAN_RF0R_FMP0) == 0) {
             chSysUnlockFromISR();
             break;
         }
         struct can_frame_s frame;
-        can_driver_stm32_retreive_rx_frame_I(&frame, &instance->can->sFIFOMailBox[1]);
-        can_driver_rx_frame_received_I(instance->frontend, 1, rx_systime, &frame);
-        instance->can->RF1R = CAN_RF1R_RFOM1;
+        can_driver_stm32_retreive_rx_frame_I(&frame, &instance->can->sFIFOMailBox[fifo_idx]);
+        can_driver_rx_frame_received_I(instance->frontend, fifo_idx, rx_systime, &frame);
+        *RFR = CAN_RF0R_RFOM0;
         chSysUnlockFromISR();
     }
 }
@@ -247,7 +502,15 @@ OSAL_IRQ_HANDLER(STM32_CAN1_TX_HANDLER) {
 OSAL_IRQ_HANDLER(STM32_CAN1_RX0_HANDLER) {
     OSAL_IRQ_PROLOGUE();
 
-    stm32_can_rx_handler(&can1_instance);
+    stm32_can_rx_handler(&can1_instance, 0);
+
+    OSAL_IRQ_EPILOGUE();
+}
+
+OSAL_IRQ_HANDLER(STM32_CAN1_RX1_HANDLER) {
+    OSAL_IRQ_PROLOGUE();
+
+    stm32_can_rx_handler(&can1_instance, 1);
 
     OSAL_IRQ_EPILOGUE();
 }
@@ -64,15 +64,18 @@ static void gps_ubx_frame_received(size_t length, uint8_t *buffer)
     while(topic_handle) {
         if (topic_handle->class_id == buffer[2] && topic_handle->msg_id == buffer[3]) {
             //publish gps message
-            struct gps_msg msg;
             if (topic_handle->frame_buffer_len >= length - 8) {
                 memcpy(topic_handle->frame_buffer, buffer+6, length - 8);
             }
-            msg.class_id = buffer[2];
-            msg.msg_id = buffer[3];
-            msg.msg_len = length - 8;
-            msg.frame_buffer = topic_handle->frame_buffer;
-            pubsub_publish_message(topic_handle->topic, sizeof(struct gps_msg), pubsub_copy_writer_func, &msg);
+            struct gps_msg* msg = pubsub_publish_begin(topic_handle->topic, sizeof(struct gps_msg));
+            if (msg) {
+                msg->gps_handle = topic_handle->gps_handle;
+                msg->class_id = buffer[2];
+                msg->msg_id = buffer[3];
+                msg->msg_len = length - 8;
+                msg->frame_buffer = topic_handle->frame_buffer;
+                pubsub_publish_commit(msg);
+            }
         }
         topic_handle = topic_handle->next;
     }
@@ -25,7 +25,7 @@ struct pin_change_publisher_topic_s {
     struct pin_change_publisher_topic_s* next;
 };
 
-struct worker_thread_publisher_task_s publisher_task;
+static struct worker_thread_channel_task_s channel_task;
 
 static struct pin_change_publisher_topic_s *irq_topic_list_head;
 
@@ -33,7 +33,7 @@ static EXTConfig extcfg;
 
 RUN_ON(PUBSUB_TOPIC_INIT) {
     extStart(&EXTD1, &extcfg);
-    worker_thread_add_publisher_task(&WT, &publisher_task, sizeof(struct pin_change_msg_s), PIN_CHANGE_PUBLISHER_QUEUE_DEPTH);
+    worker_thread_add_channel_task(&WT, &channel_task, sizeof(struct pin_change_msg_s), PIN_CHANGE_PUBLISHER_QUEUE_DEPTH, NULL, NULL);
 }
 
 MEMORYPOOL_DECL(pin_change_publisher_topic_list_pool, sizeof(struct pin_change_publisher_topic_s), chCoreAllocAlignedI);
@@ -128,7 +128,7 @@ static void pin_change_publisher_common_handler(EXTDriver *extp, expchannel_t ch
             extChannelDisableI(extp, channel);
         }
         struct pin_change_msg_s msg = {chVTGetSystemTimeX()};
-        worker_thread_publisher_task_publish_I(&publisher_task, irq_topic->topic, sizeof(struct pin_change_msg_s), pubsub_copy_writer_func, &msg);
+        worker_thread_channel_task_publish_I(&channel_task, irq_topic->topic, sizeof(struct pin_change_msg_s), pubsub_copy_writer_func, &msg);
         chSysUnlockFromISR();
     }
 }
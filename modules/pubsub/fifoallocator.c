@@ -86,6 +86,23 @@ size_t fifoallocator_get_block_size(const void* block) {
     return ((struct fifoallocator_block_s*)((uint8_t*)block - offsetof(struct fifoallocator_block_s, data)))->data_size;
 }
 
+// Returns the number of bytes spanned by allocated blocks, including alignment padding and any space skipped at the end of the
+// memory pool when the allocated blocks wrap around.
+size_t fifoallocator_get_used_size(const struct fifoallocator_instance_s* instance) {
+    if (!instance || !instance->oldest || !instance->newest) {
+        return 0;
+    }
+
+    size_t oldest = (size_t)instance->oldest;
+    size_t newest_end = (size_t)instance->newest->data + instance->newest->data_size;
+
+    if (oldest <= (size_t)instance->newest) {
+        return newest_end-oldest;
+    } else {
+        return instance->memory_pool_size-(oldest-newest_end);
+    }
+}
+
 void fifoallocator_pop_oldest(struct fifoallocator_instance_s* instance) {
     if (!instance || !instance->oldest) {
         return;
@@ -23,3 +23,4 @@ void* fifoallocator_allocate(struct fifoallocator_instance_s* instance, size_t m
 void* fifoallocator_peek_oldest(struct fifoallocator_instance_s* instance);
 void fifoallocator_pop_oldest(struct fifoallocator_instance_s* instance);
 size_t fifoallocator_get_block_size(const void* block);
+size_t fifoallocator_get_used_size(const struct fifoallocator_instance_s* instance);
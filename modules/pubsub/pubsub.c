@@ -9,12 +9,28 @@
 
 PUBSUB_TOPIC_GROUP_DECLARE_EXTERN(PUBSUB_DEFAULT_TOPIC_GROUP);
 
+#if (PUBSUB_TOPIC_REGISTRY_BUCKETS & (PUBSUB_TOPIC_REGISTRY_BUCKETS-1)) != 0
+#error PUBSUB_TOPIC_REGISTRY_BUCKETS must be a power of two.
+#endif
+
+static struct pubsub_topic_group_s* topic_group_list_head;
+static struct pubsub_topic_s* topic_list_head;
+static struct pubsub_topic_s* topic_registry[PUBSUB_TOPIC_REGISTRY_BUCKETS];
+
 void pubsub_create_topic_group(struct pubsub_topic_group_s* topic_group, size_t memory_pool_size, void* memory_pool) {
     if (!topic_group || !memory_pool) {
         return;
     }
 
     fifoallocator_init(&topic_group->allocator, memory_pool_size, memory_pool);
+
+#if PUBSUB_STATS_ENABLED
+    memset(&topic_group->stats, 0, sizeof(topic_group->stats));
+#endif
+
+    chSysLock();
+    LINKED_LIST_APPEND(struct pubsub_topic_group_s, topic_group_list_head, topic_group);
+    chSysUnlock();
 }
 
 void pubsub_init_topic(struct pubsub_topic_s* topic, struct pubsub_topic_group_s* topic_group) {
@@ -26,9 +42,139 @@ void pubsub_init_topic(struct pubsub_topic_s* topic, struct pubsub_topic_group_s
         topic_group = &PUBSUB_DEFAULT_TOPIC_GROUP;
     }
 
+    topic->message_list_head = NULL;
     topic->message_list_tail = NULL;
+    topic->next_seq = 0;
     topic->group = topic_group;
     topic->listener_list_head = NULL;
+    topic->max_message_size = 0;
+    topic->id = 0;
+    topic->name = NULL;
+    topic->registered = false;
+    topic->next_in_registry_bucket = NULL;
+
+#if PUBSUB_STATS_ENABLED
+    memset(&topic->stats, 0, sizeof(topic->stats));
+#endif
+
+    chSysLock();
+    LINKED_LIST_APPEND(struct pubsub_topic_s, topic_list_head, topic);
+    chSysUnlock();
+}
+
+static uint32_t pubsub_topic_registry_get_bucket(uint32_t id) {
+    // Fibonacci hashing, so that sequential IDs spread across buckets
+    return ((uint32_t)(id*2654435769UL) >> 16) & (PUBSUB_TOPIC_REGISTRY_BUCKETS-1);
+}
+
+static struct pubsub_topic_s* pubsub_find_topic_I(uint32_t id) {
+    struct pubsub_topic_s* topic = topic_registry[pubsub_topic_registry_get_bucket(id)];
+    while (topic && topic->id != id) {
+        topic = topic->next_in_registry_bucket;
+    }
+
+    return topic;
+}
+
+bool pubsub_register_topic(struct pubsub_topic_s* topic, uint32_t id, const char* name) {
+    if (!topic) {
+        return false;
+    }
+
+    chSysLock();
+    if (topic->registered || pubsub_find_topic_I(id)) {
+        chSysUnlock();
+        return false;
+    }
+
+    topic->id = id;
+    topic->name = name;
+    topic->registered = true;
+
+    uint32_t bucket = pubsub_topic_registry_get_bucket(id);
+    topic->next_in_registry_bucket = topic_registry[bucket];
+    topic_registry[bucket] = topic;
+    chSysUnlock();
+
+    return true;
+}
+
+uint32_t pubsub_get_topic_id_from_name(const char* name) {
+    if (!name) {
+        return PUBSUB_TOPIC_ID_NAME_FLAG;
+    }
+
+    uint64_t hash = FNV_1_OFFSET_BASIS_64;
+    hash_fnv_1a(strlen(name), (const uint8_t*)name, &hash);
+
+    // xor-folding per http://www.isthe.com/chongo/tech/comp/fnv/
+    return (uint32_t)((hash>>32) ^ hash) | PUBSUB_TOPIC_ID_NAME_FLAG;
+}
+
+bool pubsub_init_named_topic(struct pubsub_topic_s* topic, struct pubsub_topic_group_s* topic_group, const char* name) {
+    pubsub_init_topic(topic, topic_group);
+    return pubsub_register_topic(topic, pubsub_get_topic_id_from_name(name), name);
+}
+
+struct pubsub_topic_s* pubsub_find_topic(uint32_t id) {
+    chSysLock();
+    struct pubsub_topic_s* ret = pubsub_find_topic_I(id);
+    chSysUnlock();
+    return ret;
+}
+
+struct pubsub_topic_s* pubsub_find_topic_by_name(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+
+    struct pubsub_topic_s* ret = pubsub_find_topic(pubsub_get_topic_id_from_name(name));
+
+    if (ret && (!ret->name || strcmp(ret->name, name) != 0)) {
+        return NULL;
+    }
+
+    return ret;
+}
+
+uint32_t pubsub_topic_get_id(const struct pubsub_topic_s* topic) {
+    if (!topic) {
+        return 0;
+    }
+
+    return topic->id;
+}
+
+const char* pubsub_topic_get_name(const struct pubsub_topic_s* topic) {
+    if (!topic) {
+        return NULL;
+    }
+
+    return topic->name;
+}
+
+struct pubsub_topic_group_s* pubsub_topic_get_group(const struct pubsub_topic_s* topic) {
+    if (!topic) {
+        return NULL;
+    }
+
+    return topic->group;
+}
+
+uint32_t pubsub_topic_get_publish_count(const struct pubsub_topic_s* topic) {
+    if (!topic) {
+        return 0;
+    }
+
+    return topic->next_seq;
+}
+
+size_t pubsub_topic_get_max_message_size(const struct pubsub_topic_s* topic) {
+    if (!topic) {
+        return 0;
+    }
+
+    return topic->max_message_size;
 }
 
 void pubsub_listener_init_and_register(struct pubsub_listener_s* listener, struct pubsub_topic_s* topic, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx) {
@@ -40,14 +186,30 @@ void pubsub_listener_init_and_register(struct pubsub_listener_s* listener, struc
     listener->topic = topic;
     listener->next_message = NULL;
     listener->waiting_thread_reference_ptr = NULL;
+    listener->ready_mask_ptr = NULL;
+    listener->ready_mask = 0;
     listener->handler_cb = handler_cb;
+    listener->batch_handler_cb = NULL;
     listener->handler_cb_ctx = handler_cb_ctx;
+    listener->max_batch_size = 0;
+    listener->batch_time_budget = TIME_INFINITE;
+    listener->filter_cb = NULL;
+    listener->filter_cb_ctx = NULL;
+    listener->decimation = 1;
+    listener->decimation_count = 0;
+    listener->min_interval = 0;
+    listener->last_accept_systime = 0;
+    listener->next_message_accepted = false;
     chMtxObjectInit(&listener->mtx);
     listener->next = NULL;
     listener->misses = 0;
+#if PUBSUB_STATS_ENABLED
+    memset(&listener->stats, 0, sizeof(listener->stats));
+#endif
 
-    // append listener to topic's listener list
+    // append listener to topic's listener list, starting at the next message published
     chSysLock();
+    listener->next_seq = topic->next_seq;
     LINKED_LIST_APPEND(struct pubsub_listener_s, topic->listener_list_head, listener);
     chSysUnlock();
 }
@@ -69,41 +231,194 @@ void pubsub_listener_reset(struct pubsub_listener_s* listener) {
     }
 
     chMtxLock(&listener->mtx);
+    chSysLock();
+    listener->next_seq = listener->topic->next_seq;
     listener->next_message = NULL;
+    listener->next_message_accepted = false;
+    chSysUnlock();
     chMtxUnlock(&listener->mtx);
 }
 
+void pubsub_listener_set_filter(struct pubsub_listener_s* listener, pubsub_message_filter_func_ptr filter_cb, void* filter_cb_ctx, uint32_t decimation, systime_t min_interval) {
+    if (!listener) {
+        return;
+    }
+
+    chSysLock();
+    listener->filter_cb = filter_cb;
+    listener->filter_cb_ctx = filter_cb_ctx;
+    listener->decimation = decimation;
+    listener->decimation_count = 0;
+    listener->min_interval = min_interval;
+    // Accept the next message regardless of min_interval
+    listener->last_accept_systime = chVTGetSystemTimeX()-min_interval;
+    chSysUnlock();
+}
+
+static uint32_t pubsub_topic_get_oldest_seq_I(const struct pubsub_topic_s* topic) {
+    return topic->message_list_head ? topic->message_list_head->seq : topic->next_seq;
+}
+
+// - Moves the listener past message, which must not have been deleted.
+static void pubsub_listener_advance_I(struct pubsub_listener_s* listener, const struct pubsub_message_s* message) {
+    listener->next_seq = message->seq+1;
+    listener->next_message = message->next_in_topic;
+    listener->next_message_accepted = false;
+}
+
+// - Applies the listener's filter callback, minimum interval and decimation to a message. Each message is evaluated at most once
+//   per listener, in order, so that decimation and minimum interval state stays consistent.
+static bool pubsub_listener_accepts_message_I(struct pubsub_listener_s* listener, const struct pubsub_message_s* message) {
+    if (listener->filter_cb) {
+        size_t message_size = fifoallocator_get_block_size(message)-sizeof(struct pubsub_message_s);
+        if (!listener->filter_cb(message_size, message->data, listener->filter_cb_ctx)) {
+            return false;
+        }
+    }
+
+    if (listener->min_interval != 0 && message->publish_systime-listener->last_accept_systime < listener->min_interval) {
+        return false;
+    }
+
+    if (listener->decimation > 1) {
+        listener->decimation_count++;
+        if (listener->decimation_count < listener->decimation) {
+            return false;
+        }
+        listener->decimation_count = 0;
+    }
+
+    listener->last_accept_systime = message->publish_systime;
+    return true;
+}
+
+// - Returns the listener's next message, or NULL if it has handled every message on the topic.
+// - Messages are deleted without touching listeners, so next_message is only valid while next_seq is not older than the topic's
+//   oldest message. Otherwise, the listener skips to the oldest message and counts the deleted messages as misses.
+// - Messages rejected by the listener's filter are skipped.
+static struct pubsub_message_s* pubsub_listener_get_next_message_I(struct pubsub_listener_s* listener) {
+    struct pubsub_topic_s* topic = listener->topic;
+
+    if (listener->next_seq == topic->next_seq) {
+        return NULL;
+    }
+
+    uint32_t oldest_seq = pubsub_topic_get_oldest_seq_I(topic);
+    if ((int32_t)(oldest_seq - listener->next_seq) > 0) {
+        listener->misses += oldest_seq - listener->next_seq;
+        listener->next_seq = oldest_seq;
+        listener->next_message = topic->message_list_head;
+        listener->next_message_accepted = false;
+    }
+
+    while (listener->next_message && !listener->next_message_accepted) {
+        if (pubsub_listener_accepts_message_I(listener, listener->next_message)) {
+            listener->next_message_accepted = true;
+        } else {
+#if PUBSUB_STATS_ENABLED
+            listener->stats.filtered_count++;
+#endif
+            pubsub_listener_advance_I(listener, listener->next_message);
+        }
+    }
+
+    return listener->next_message;
+}
+
+#if PUBSUB_STATS_ENABLED
+static uint32_t pubsub_listener_get_backlog_I(const struct pubsub_listener_s* listener) {
+    uint32_t oldest_seq = pubsub_topic_get_oldest_seq_I(listener->topic);
+    uint32_t first_seq = (int32_t)(oldest_seq - listener->next_seq) > 0 ? oldest_seq : listener->next_seq;
+
+    return listener->topic->next_seq - first_seq;
+}
+#endif
+
+bool pubsub_listener_has_message_I(struct pubsub_listener_s* listener) {
+    chDbgCheckClassI();
+
+    return pubsub_listener_get_next_message_I(listener) != NULL;
+}
+
 bool pubsub_listener_has_message(struct pubsub_listener_s* listener) {
-    return listener->next_message != NULL;
+    chSysLock();
+    bool ret = pubsub_listener_has_message_I(listener);
+    chSysUnlock();
+    return ret;
+}
+
+bool pubsub_listener_get_next_message_publish_systime_I(struct pubsub_listener_s* listener, systime_t* publish_systime) {
+    chDbgCheckClassI();
+
+    struct pubsub_message_s* message = pubsub_listener_get_next_message_I(listener);
+    if (!message) {
+        return false;
+    }
+
+    *publish_systime = message->publish_systime;
+    return true;
 }
 
 void pubsub_copy_writer_func(size_t msg_size, void* msg, void* ctx) {
     memcpy(msg, ctx, msg_size);
 }
 
+// - Deletes the oldest message in a topic. Listeners that have not handled it notice lazily, from the gap in sequence numbers.
 static void pubsub_delete_message_S(struct pubsub_message_s* message_to_delete) {
-    struct pubsub_listener_s* listener = message_to_delete->topic->listener_list_head;
+    struct pubsub_topic_s* topic = message_to_delete->topic;
+
+    chDbgAssert(topic->message_list_head == message_to_delete, "messages must be deleted in order");
+
+    topic->message_list_head = message_to_delete->next_in_topic;
+
+    if (topic->message_list_tail == message_to_delete) {
+        topic->message_list_tail = NULL;
+    }
+}
+
+static struct pubsub_message_s* pubsub_get_message_from_payload(const void* msg) {
+    return (struct pubsub_message_s*)((const uint8_t*)msg - offsetof(struct pubsub_message_s, data));
+}
+
+void pubsub_message_pin_I(const void* msg) {
+    chDbgCheckClassI();
 
-    if (message_to_delete->topic->message_list_tail == message_to_delete) {
-        message_to_delete->topic->message_list_tail = NULL;
+    if (!msg) {
+        return;
     }
 
-    while (listener) {
-        if (listener->next_message == message_to_delete) {
-            chMtxLockS(&listener->mtx);
-            if (listener->next_message == message_to_delete) {
-                listener->next_message = message_to_delete->next_in_topic;
-                listener->misses++;
-            }
-            chMtxUnlockS(&listener->mtx);
-        }
-        listener = listener->next;
+    struct pubsub_message_s* message = pubsub_get_message_from_payload(msg);
+    chDbgCheck(message->pin_count != UINT16_MAX);
+    message->pin_count++;
+}
+
+void pubsub_message_pin(const void* msg) {
+    chSysLock();
+    pubsub_message_pin_I(msg);
+    chSysUnlock();
+}
+
+void pubsub_message_unpin_I(const void* msg) {
+    chDbgCheckClassI();
+
+    if (!msg) {
+        return;
     }
+
+    struct pubsub_message_s* message = pubsub_get_message_from_payload(msg);
+    chDbgCheck(message->pin_count != 0);
+    message->pin_count--;
+}
+
+void pubsub_message_unpin(const void* msg) {
+    chSysLock();
+    pubsub_message_unpin_I(msg);
+    chSysUnlock();
 }
 
-void pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx) {
+void* pubsub_publish_begin(struct pubsub_topic_s* topic, size_t size) {
     if (!topic || !topic->group || !topic->listener_list_head) {
-        return;
+        return NULL;
     }
 
     struct pubsub_message_s* message;
@@ -117,6 +432,32 @@ void pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_me
 
         // Delete the oldest message in the topic group
         struct pubsub_message_s* message_to_delete = fifoallocator_peek_oldest(&topic->group->allocator);
+        if (!message_to_delete) {
+            // Message does not fit in the topic group's memory pool
+#if PUBSUB_STATS_ENABLED
+            topic->stats.publish_failures++;
+            topic->group->stats.allocation_failures++;
+#endif
+            chSysUnlock();
+            return NULL;
+        }
+
+        if (message_to_delete->pin_count != 0) {
+            // The oldest message is pinned - fail instead of waiting for it to be unpinned
+#if PUBSUB_STATS_ENABLED
+            topic->stats.publish_failures++;
+            topic->group->stats.pin_failures++;
+#endif
+            chSysUnlock();
+            return NULL;
+        }
+
+#if PUBSUB_STATS_ENABLED
+        topic->stats.evictions_caused++;
+        message_to_delete->topic->stats.evictions_suffered++;
+        topic->group->stats.evictions++;
+#endif
+
         pubsub_delete_message_S(message_to_delete);
 
         if (fifoallocator_peek_oldest(&topic->group->allocator) == message_to_delete) {
@@ -128,31 +469,75 @@ void pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_me
 
     message->topic = topic;
     message->next_in_topic = NULL;
+    message->pin_count = 0;
 
-    if (writer_cb) {
-        writer_cb(size, message->data, ctx);
+#if PUBSUB_STATS_ENABLED
+    size_t used_size = fifoallocator_get_used_size(&topic->group->allocator);
+    if (used_size > topic->group->stats.used_high_water) {
+        topic->group->stats.used_high_water = used_size;
+    }
+#endif
+
+    return message->data;
+}
+
+void pubsub_publish_commit(void* msg) {
+    chDbgCheckClassS();
+
+    struct pubsub_message_s* message = pubsub_get_message_from_payload(msg);
+    struct pubsub_topic_s* topic = message->topic;
+
+    message->seq = topic->next_seq++;
+
+    size_t message_size = fifoallocator_get_block_size(message)-sizeof(struct pubsub_message_s);
+    if (message_size > topic->max_message_size) {
+        topic->max_message_size = message_size;
     }
 
     if (topic->message_list_tail) {
         chDbgCheck(topic->message_list_tail != message); // Circular reference
         topic->message_list_tail->next_in_topic = message;
+    } else {
+        topic->message_list_head = message;
     }
     topic->message_list_tail = message;
 
-    // Set listeners' next messages
+    message->publish_systime = chVTGetSystemTimeX();
+
+#if PUBSUB_STATS_ENABLED
+    topic->stats.publish_count++;
+    topic->stats.publish_bytes += message_size;
+#endif
+
+    // Set next message of listeners that had handled every message, unless their filter rejects it. Listeners with a backlog
+    // evaluate their filter once they get to the message.
     struct pubsub_listener_s* listener = topic->listener_list_head;
     while (listener) {
-        if (!listener->next_message) {
+        if (listener->next_seq == message->seq) {
             listener->next_message = message;
+            listener->next_message_accepted = false;
+            pubsub_listener_get_next_message_I(listener);
+        }
+
+#if PUBSUB_STATS_ENABLED
+        uint32_t backlog = pubsub_listener_get_backlog_I(listener);
+        if (backlog > listener->stats.backlog_high_water) {
+            listener->stats.backlog_high_water = backlog;
         }
+#endif
 
         listener = listener->next;
     }
 
-    // Wake listener threads
+    // Flag and wake threads of listeners with messages to handle
     listener = topic->listener_list_head;
     while (listener) {
-        if (listener->waiting_thread_reference_ptr && ((thread_t*)*listener->waiting_thread_reference_ptr)->state == CH_STATE_SUSPENDED) {
+        if (listener->next_seq != topic->next_seq && listener->ready_mask_ptr) {
+            *listener->ready_mask_ptr |= listener->ready_mask;
+        }
+
+        // The thread reference is NULL while the thread is not waiting
+        if (listener->next_seq != topic->next_seq && listener->waiting_thread_reference_ptr && *listener->waiting_thread_reference_ptr && ((thread_t*)*listener->waiting_thread_reference_ptr)->state == CH_STATE_SUSPENDED) {
             chThdResumeS(listener->waiting_thread_reference_ptr, (msg_t)listener);
         }
 
@@ -162,6 +547,21 @@ void pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_me
     chSysUnlock();
 }
 
+bool pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx) {
+    void* msg = pubsub_publish_begin(topic, size);
+
+    if (!msg) {
+        return false;
+    }
+
+    if (writer_cb) {
+        writer_cb(size, msg, ctx);
+    }
+
+    pubsub_publish_commit(msg);
+    return true;
+}
+
 void pubsub_listener_set_handler_cb(struct pubsub_listener_s* listener, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx) {
     if (!listener) {
         return;
@@ -173,6 +573,103 @@ void pubsub_listener_set_handler_cb(struct pubsub_listener_s* listener, pubsub_m
     chMtxUnlock(&listener->mtx);
 }
 
+#if PUBSUB_STATS_ENABLED
+static void pubsub_listener_record_latency_I(struct pubsub_listener_s* listener, const struct pubsub_message_s* message) {
+    systime_t latency = chVTTimeElapsedSinceX(message->publish_systime);
+
+    size_t bin = 0;
+    if (latency != 0) {
+        bin = MIN(32-__builtin_clz((uint32_t)latency), PUBSUB_STATS_LATENCY_HISTOGRAM_BINS-1);
+    }
+
+    listener->stats.handled_count++;
+    listener->stats.latency_histogram[bin]++;
+}
+#endif
+
+void pubsub_listener_set_batch_handler_cb(struct pubsub_listener_s* listener, pubsub_batch_handler_func_ptr batch_handler_cb, void* handler_cb_ctx, size_t max_batch_size, systime_t time_budget) {
+    if (!listener) {
+        return;
+    }
+
+    chMtxLock(&listener->mtx);
+    listener->batch_handler_cb = batch_handler_cb;
+    listener->handler_cb_ctx = handler_cb_ctx;
+    listener->max_batch_size = max_batch_size;
+    listener->batch_time_budget = time_budget;
+    chMtxUnlock(&listener->mtx);
+}
+
+// - Moves the listener past the batch's current message. Called with the listener's mutex held.
+static void pubsub_batch_release_current(struct pubsub_batch_s* batch) {
+    struct pubsub_listener_s* listener = batch->listener;
+
+    if (!batch->current) {
+        return;
+    }
+
+    // The current message is pinned, so it cannot have been deleted
+    chSysLock();
+    pubsub_listener_advance_I(listener, batch->current);
+    pubsub_message_unpin_I(batch->current->data);
+    chSysUnlock();
+
+    batch->current = NULL;
+}
+
+const void* pubsub_batch_next(struct pubsub_batch_s* batch, size_t* msg_size) {
+    if (!batch) {
+        return NULL;
+    }
+
+    struct pubsub_listener_s* listener = batch->listener;
+
+    pubsub_batch_release_current(batch);
+
+    if (listener->max_batch_size != 0 && batch->count >= listener->max_batch_size) {
+        return NULL;
+    }
+
+    if (batch->count != 0 && listener->batch_time_budget != TIME_INFINITE && chVTTimeElapsedSinceX(batch->begin_systime) >= listener->batch_time_budget) {
+        return NULL;
+    }
+
+    chSysLock();
+    struct pubsub_message_s* message = pubsub_listener_get_next_message_I(listener);
+
+    if (!message) {
+        chSysUnlock();
+        return NULL;
+    }
+
+    pubsub_message_pin_I(message->data);
+    batch->current = message;
+    batch->count++;
+
+#if PUBSUB_STATS_ENABLED
+    pubsub_listener_record_latency_I(listener, message);
+#endif
+
+    if (msg_size) {
+        *msg_size = fifoallocator_get_block_size(message)-sizeof(struct pubsub_message_s);
+    }
+    chSysUnlock();
+
+    return message->data;
+}
+
+static void pubsub_listener_handle_batch(struct pubsub_listener_s* listener) {
+    struct pubsub_batch_s batch;
+    batch.listener = listener;
+    batch.current = NULL;
+    batch.count = 0;
+    batch.begin_systime = chVTGetSystemTimeX();
+
+    listener->batch_handler_cb(&batch, listener->handler_cb_ctx);
+
+    pubsub_batch_release_current(&batch);
+}
+
 void pubsub_listener_handle_until_timeout(struct pubsub_listener_s* listener, systime_t timeout) {
     pubsub_multiple_listener_handle_until_timeout(1, &listener, timeout);
 }
@@ -187,25 +684,48 @@ bool pubsub_multiple_listener_handle_one_timeout(size_t num_listeners, struct pu
     chSysLock();
     struct pubsub_listener_s* listener_with_message = pubsub_multiple_listener_wait_timeout_S(num_listeners, listeners, timeout);
 
-    if (listener_with_message) {
-        chMtxLockS(&listener_with_message->mtx);
+    if (!listener_with_message) {
         chSysUnlock();
+        return false;
+    }
 
-        struct pubsub_message_s* message = listener_with_message->next_message;
-        listener_with_message->next_message = message->next_in_topic;
+    chMtxLockS(&listener_with_message->mtx);
 
-        if (listener_with_message->handler_cb) {
-            size_t message_size = fifoallocator_get_block_size(message)-sizeof(struct pubsub_message_s);
+    if (listener_with_message->batch_handler_cb) {
+        chSysUnlock();
 
-            listener_with_message->handler_cb(message_size, message->data, listener_with_message->handler_cb_ctx);
-        }
+        pubsub_listener_handle_batch(listener_with_message);
 
         chMtxUnlock(&listener_with_message->mtx);
         return true;
-    } else {
+    }
+
+    // The message may have been deleted while waiting for the mutex
+    struct pubsub_message_s* message = pubsub_listener_get_next_message_I(listener_with_message);
+    if (!message) {
         chSysUnlock();
+        chMtxUnlock(&listener_with_message->mtx);
         return false;
     }
+
+    pubsub_listener_advance_I(listener_with_message, message);
+    pubsub_message_pin_I(message->data);
+    size_t message_size = fifoallocator_get_block_size(message)-sizeof(struct pubsub_message_s);
+
+#if PUBSUB_STATS_ENABLED
+    pubsub_listener_record_latency_I(listener_with_message, message);
+#endif
+
+    chSysUnlock();
+
+    if (listener_with_message->handler_cb) {
+        listener_with_message->handler_cb(message_size, message->data, listener_with_message->handler_cb_ctx);
+    }
+
+    pubsub_message_unpin(message->data);
+
+    chMtxUnlock(&listener_with_message->mtx);
+    return true;
 }
 
 void pubsub_multiple_listener_handle_until_timeout(size_t num_listeners, struct pubsub_listener_s** listeners, systime_t timeout) {
@@ -229,12 +749,23 @@ void pubsub_listener_set_waiting_thread_reference(struct pubsub_listener_s* list
     listener->waiting_thread_reference_ptr = trpp;
 }
 
+void pubsub_listener_set_ready_mask(struct pubsub_listener_s* listener, uint32_t* ready_mask_ptr, uint32_t ready_mask) {
+    if (!listener) {
+        return;
+    }
+
+    chSysLock();
+    listener->ready_mask_ptr = ready_mask_ptr;
+    listener->ready_mask = ready_mask;
+    chSysUnlock();
+}
+
 static struct pubsub_listener_s* pubsub_multiple_listener_wait_timeout_S(size_t num_listeners, struct pubsub_listener_s** listeners, systime_t timeout) {
     chDbgCheckClassS();
 
     // Check for immediately available messages
     for (size_t i=0; i<num_listeners; i++) {
-        if (listeners && listeners[i] && listeners[i]->next_message) {
+        if (listeners && listeners[i] && pubsub_listener_get_next_message_I(listeners[i])) {
             return listeners[i];
         }
     }
@@ -272,3 +803,187 @@ static struct pubsub_listener_s* pubsub_multiple_listener_wait_timeout_S(size_t
 
     return ret;
 }
+
+bool pubsub_iterate_topic_groups(struct pubsub_topic_group_s** topic_group_ptr) {
+    if (!topic_group_ptr) {
+        return false;
+    }
+
+    if (!(*topic_group_ptr)) {
+        *topic_group_ptr = topic_group_list_head;
+    } else {
+        *topic_group_ptr = (*topic_group_ptr)->next;
+    }
+
+    return *topic_group_ptr != NULL;
+}
+
+bool pubsub_iterate_topics(struct pubsub_topic_s** topic_ptr) {
+    if (!topic_ptr) {
+        return false;
+    }
+
+    if (!(*topic_ptr)) {
+        *topic_ptr = topic_list_head;
+    } else {
+        *topic_ptr = (*topic_ptr)->next;
+    }
+
+    return *topic_ptr != NULL;
+}
+
+bool pubsub_topic_iterate_listeners(struct pubsub_topic_s* topic, struct pubsub_listener_s** listener_ptr) {
+    if (!topic || !listener_ptr) {
+        return false;
+    }
+
+    if (!(*listener_ptr)) {
+        *listener_ptr = topic->listener_list_head;
+    } else {
+        *listener_ptr = (*listener_ptr)->next;
+    }
+
+    return *listener_ptr != NULL;
+}
+
+#if PUBSUB_STATS_ENABLED
+void pubsub_topic_get_stats(struct pubsub_topic_s* topic, struct pubsub_topic_stats_s* ret, bool reset) {
+    if (!topic || !ret) {
+        return;
+    }
+
+    chSysLock();
+    *ret = topic->stats;
+    if (reset) {
+        memset(&topic->stats, 0, sizeof(topic->stats));
+    }
+    chSysUnlock();
+}
+
+void pubsub_topic_group_get_stats(struct pubsub_topic_group_s* topic_group, struct pubsub_topic_group_stats_s* ret, bool reset) {
+    if (!topic_group || !ret) {
+        return;
+    }
+
+    chSysLock();
+    *ret = topic_group->stats;
+    if (reset) {
+        memset(&topic_group->stats, 0, sizeof(topic_group->stats));
+        topic_group->stats.used_high_water = fifoallocator_get_used_size(&topic_group->allocator);
+    }
+    chSysUnlock();
+}
+
+void pubsub_listener_get_stats(struct pubsub_listener_s* listener, struct pubsub_listener_stats_s* ret, bool reset) {
+    if (!listener || !ret) {
+        return;
+    }
+
+    chSysLock();
+    // Messages deleted since the listener last looked for one are counted here without moving the listener, so that the
+    // snapshot neither runs the listener's filter on this thread nor changes which messages the listener handles
+    uint32_t oldest_seq = pubsub_topic_get_oldest_seq_I(listener->topic);
+    uint32_t pending_misses = (int32_t)(oldest_seq - listener->next_seq) > 0 ? oldest_seq - listener->next_seq : 0;
+
+    *ret = listener->stats;
+    ret->misses = listener->misses + pending_misses;
+    ret->backlog = pubsub_listener_get_backlog_I(listener);
+    if (reset) {
+        memset(&listener->stats, 0, sizeof(listener->stats));
+        listener->stats.backlog_high_water = ret->backlog;
+        // The pending misses are added again once the listener skips them, which brings this back to zero
+        listener->misses = 0U - pending_misses;
+    }
+    chSysUnlock();
+}
+#endif
+
+void pubsub_init_sample_topic(struct pubsub_sample_topic_s* topic, size_t msg_max_size, void* memory) {
+    if (!topic || !memory) {
+        return;
+    }
+
+    const size_t slot_align = __alignof__(struct pubsub_sample_slot_s);
+    size_t slot_size = (sizeof(struct pubsub_sample_slot_s)+msg_max_size+slot_align-1) & ~(slot_align-1);
+
+    topic->seq = 0;
+    topic->msg_max_size = msg_max_size;
+    topic->slots[0] = memory;
+    topic->slots[1] = (struct pubsub_sample_slot_s*)((uint8_t*)memory + slot_size);
+    topic->slots[0]->size = 0;
+    topic->slots[1]->size = 0;
+}
+
+bool pubsub_sample_publish_I(struct pubsub_sample_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx) {
+    chDbgCheckClassI();
+
+    if (!topic || size > topic->msg_max_size) {
+        return false;
+    }
+
+    // Readers of the current message use the other slot, so it is never written while they copy it
+    uint32_t seq = topic->seq+1;
+    if (seq == 0) {
+        // Sequence number 0 means "nothing published". Skip by two to keep slot selection consistent.
+        seq = 2;
+    }
+
+    struct pubsub_sample_slot_s* slot = topic->slots[seq&1];
+    slot->size = size;
+
+    if (writer_cb) {
+        writer_cb(size, slot->data, ctx);
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    topic->seq = seq;
+
+    return true;
+}
+
+bool pubsub_sample_publish(struct pubsub_sample_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx) {
+    chSysLock();
+    bool ret = pubsub_sample_publish_I(topic, size, writer_cb, ctx);
+    chSysUnlock();
+    return ret;
+}
+
+size_t pubsub_sample_read(struct pubsub_sample_topic_s* topic, void* buf, size_t buf_size, uint32_t* seq) {
+    if (!topic || !buf) {
+        return 0;
+    }
+
+    while (true) {
+        uint32_t seq_begin = topic->seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (seq_begin == 0) {
+            return 0;
+        }
+
+        const struct pubsub_sample_slot_s* slot = topic->slots[seq_begin&1];
+
+        // The slot may be rewritten under us, so its size is read exactly once and bounded before it is trusted
+        size_t size = __atomic_load_n(&slot->size, __ATOMIC_RELAXED);
+        size = MIN(size, topic->msg_max_size);
+        size = MIN(size, buf_size);
+        memcpy(buf, slot->data, size);
+
+        // If a publish completed while copying, the next one may have been writing into this slot - retry
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (topic->seq == seq_begin) {
+            if (seq) {
+                *seq = seq_begin;
+            }
+            return size;
+        }
+    }
+}
+
+uint32_t pubsub_sample_get_seq(struct pubsub_sample_topic_s* topic) {
+    if (!topic) {
+        return 0;
+    }
+
+    return topic->seq;
+}
@@ -4,6 +4,21 @@
 #include <modules/pubsub/fifoallocator.h>
 #include <ch.h>
 
+#ifndef PUBSUB_STATS_ENABLED
+#define PUBSUB_STATS_ENABLED FALSE
+#endif
+
+#ifndef PUBSUB_TOPIC_REGISTRY_BUCKETS
+#define PUBSUB_TOPIC_REGISTRY_BUCKETS 32
+#endif
+
+// Topic IDs with the most significant bit set are reserved for IDs derived from topic names
+#define PUBSUB_TOPIC_ID_NAME_FLAG 0x80000000UL
+
+// Listener latency histogram bin i counts messages handled with a publish-to-handle latency in [2^(i-1), 2^i) ticks.
+// Bin 0 counts zero latency, and the last bin also counts everything above its range.
+#define PUBSUB_STATS_LATENCY_HISTOGRAM_BINS 16
+
 #define __PUBSUB_CONCAT(a,b) a ## b
 #define _PUBSUB_CONCAT(a,b) __PUBSUB_CONCAT(a,b)
 
@@ -17,39 +32,134 @@ RUN_BEFORE(PUBSUB_TOPIC_INIT) { \
 #define PUBSUB_TOPIC_GROUP_DECLARE_EXTERN(HANDLE_NAME) \
 extern struct pubsub_topic_group_s HANDLE_NAME;
 
+#define PUBSUB_SAMPLE_TOPIC_MEMORY_SIZE(MSG_MAX_SIZE) \
+(2*((sizeof(struct pubsub_sample_slot_s)+(MSG_MAX_SIZE)+__alignof__(struct pubsub_sample_slot_s)-1) & ~(__alignof__(struct pubsub_sample_slot_s)-1)))
+
+#define PUBSUB_SAMPLE_TOPIC_CREATE(HANDLE_NAME, MSG_MAX_SIZE) \
+struct pubsub_sample_topic_s HANDLE_NAME; \
+static uint8_t _PUBSUB_CONCAT(_pubsub_sample_topic_memory_, HANDLE_NAME)[PUBSUB_SAMPLE_TOPIC_MEMORY_SIZE(MSG_MAX_SIZE)] __attribute__((aligned)); \
+RUN_BEFORE(PUBSUB_TOPIC_INIT) { \
+    pubsub_init_sample_topic(&HANDLE_NAME, MSG_MAX_SIZE, _PUBSUB_CONCAT(_pubsub_sample_topic_memory_, HANDLE_NAME)); \
+}
+
+#define PUBSUB_SAMPLE_TOPIC_DECLARE_EXTERN(HANDLE_NAME) \
+extern struct pubsub_sample_topic_s HANDLE_NAME;
+
 typedef void (*pubsub_message_writer_func_ptr)(size_t msg_size, void* msg, void* ctx);
 typedef void (*pubsub_message_handler_func_ptr)(size_t msg_size, const void* msg, void* ctx);
+typedef bool (*pubsub_message_filter_func_ptr)(size_t msg_size, const void* msg, void* ctx);
 
 struct pubsub_message_s;
 struct pubsub_topic_s;
 struct pubsub_listener_s;
 struct pubsub_topic_group_s;
+struct pubsub_batch_s;
+
+typedef void (*pubsub_batch_handler_func_ptr)(struct pubsub_batch_s* batch, void* ctx);
+
+#if PUBSUB_STATS_ENABLED
+struct pubsub_topic_stats_s {
+    uint32_t publish_count;
+    uint32_t publish_bytes;
+    uint32_t publish_failures;
+    uint32_t evictions_caused;
+    uint32_t evictions_suffered;
+};
+
+struct pubsub_topic_group_stats_s {
+    size_t used_high_water;
+    uint32_t evictions;
+    uint32_t allocation_failures;
+    uint32_t pin_failures;
+};
+
+struct pubsub_listener_stats_s {
+    uint32_t handled_count;
+    uint32_t filtered_count;
+    uint32_t misses;
+    uint32_t backlog;
+    uint32_t backlog_high_water;
+    uint32_t latency_histogram[PUBSUB_STATS_LATENCY_HISTOGRAM_BINS];
+};
+#endif
 
 struct pubsub_message_s {
     struct pubsub_topic_s* topic;
     struct pubsub_message_s* next_in_topic;
+    uint32_t seq;
+    uint16_t pin_count;
+    systime_t publish_systime;
     uint8_t data[];
 };
 
 struct pubsub_listener_s {
     struct pubsub_topic_s* topic;
     struct pubsub_message_s* next_message;
+    uint32_t next_seq;
     thread_reference_t* waiting_thread_reference_ptr;
+    uint32_t* ready_mask_ptr;
+    uint32_t ready_mask;
     pubsub_message_handler_func_ptr handler_cb;
+    pubsub_batch_handler_func_ptr batch_handler_cb;
     void* handler_cb_ctx;
+    size_t max_batch_size;
+    systime_t batch_time_budget;
+    pubsub_message_filter_func_ptr filter_cb;
+    void* filter_cb_ctx;
+    uint32_t decimation;
+    uint32_t decimation_count;
+    systime_t min_interval;
+    systime_t last_accept_systime;
+    bool next_message_accepted;
     uint32_t misses;
     mutex_t mtx;
+#if PUBSUB_STATS_ENABLED
+    struct pubsub_listener_stats_s stats;
+#endif
     struct pubsub_listener_s* next;
 };
 
 struct pubsub_topic_s {
+    struct pubsub_message_s* message_list_head;
     struct pubsub_message_s* message_list_tail;
+    uint32_t next_seq;
     struct pubsub_topic_group_s* group;
     struct pubsub_listener_s* listener_list_head;
+    size_t max_message_size;
+    uint32_t id;
+    const char* name;
+    bool registered;
+    struct pubsub_topic_s* next_in_registry_bucket;
+#if PUBSUB_STATS_ENABLED
+    struct pubsub_topic_stats_s stats;
+#endif
+    struct pubsub_topic_s* next;
 };
 
 struct pubsub_topic_group_s {
     struct fifoallocator_instance_s allocator;
+#if PUBSUB_STATS_ENABLED
+    struct pubsub_topic_group_stats_s stats;
+#endif
+    struct pubsub_topic_group_s* next;
+};
+
+struct pubsub_batch_s {
+    struct pubsub_listener_s* listener;
+    struct pubsub_message_s* current;
+    size_t count;
+    systime_t begin_systime;
+};
+
+struct pubsub_sample_slot_s {
+    size_t size;
+    uint8_t data[] __attribute__((aligned));
+};
+
+struct pubsub_sample_topic_s {
+    volatile uint32_t seq;
+    size_t msg_max_size;
+    struct pubsub_sample_slot_s* slots[2];
 };
 
 // - Creates a new topic group with a separate memory pool and mutex. This new topic group is insulated from problems on
@@ -61,40 +171,113 @@ void pubsub_create_topic_group(struct pubsub_topic_group_s* topic_group, size_t
 // - topic_group may be NULL, in which case the default topic group is used.
 void pubsub_init_topic(struct pubsub_topic_s* topic, struct pubsub_topic_group_s* topic_group);
 
+// - Initializes a new topic object and registers it under name, with an ID derived from the name by pubsub_get_topic_id_from_name.
+// - Returns false if another topic is already registered under the same ID. The topic is still initialized in that case.
+bool pubsub_init_named_topic(struct pubsub_topic_s* topic, struct pubsub_topic_group_s* topic_group, const char* name);
+
+// - Registers an initialized topic in the topic registry under id, so that it can be found with pubsub_find_topic. name is
+//   optional and only used for introspection and pubsub_find_topic_by_name. IDs must be unique, and IDs with
+//   PUBSUB_TOPIC_ID_NAME_FLAG set are reserved for IDs derived from names.
+// - Returns false if the topic is already registered, or another topic is already registered under the same ID.
+bool pubsub_register_topic(struct pubsub_topic_s* topic, uint32_t id, const char* name);
+
+// - Returns the ID that pubsub_init_named_topic registers a topic named name under.
+uint32_t pubsub_get_topic_id_from_name(const char* name);
+
+// - Looks up a registered topic in constant time, on average. Returns NULL if no topic is registered under the ID or name.
+struct pubsub_topic_s* pubsub_find_topic(uint32_t id);
+struct pubsub_topic_s* pubsub_find_topic_by_name(const char* name);
+
+// - Topic introspection. pubsub_topic_get_id and pubsub_topic_get_name return 0 and NULL for unregistered topics.
+// - pubsub_topic_get_publish_count returns the number of messages published on the topic, modulo 2^32. Sampling it
+//   periodically gives the topic's message rate.
+// - pubsub_topic_get_max_message_size returns the size of the largest message published on the topic.
+uint32_t pubsub_topic_get_id(const struct pubsub_topic_s* topic);
+const char* pubsub_topic_get_name(const struct pubsub_topic_s* topic);
+struct pubsub_topic_group_s* pubsub_topic_get_group(const struct pubsub_topic_s* topic);
+uint32_t pubsub_topic_get_publish_count(const struct pubsub_topic_s* topic);
+size_t pubsub_topic_get_max_message_size(const struct pubsub_topic_s* topic);
+
 // - Initializes a listener object owned by the current thread and registers it on a topic.
 // - Sets the handler callback and context variable that it will be called with. Note that the handler callback will not be called
 //   until the listener's owner thread calls one of the following APIs:
 //     - pubsub_listener_handle_until_timeout
 //     - pubsub_multiple_listener_handle_until_timeout
-// - Note that while handler_cb is executing, publishers on the listener's topic group can be blocked if they need to deallocate
-//   the message that the handler is handling. This problem can be mitigated by minimizing blocking, allocating more memory to the
-//   topic group, or using a separate topic group.
+// - Note that the message is pinned while handler_cb is executing, so publishers on the listener's topic group that need to
+//   deallocate it fail instead of waiting for the handler. This problem can be mitigated by minimizing blocking, allocating more
+//   memory to the topic group, or using a separate topic group.
 void pubsub_listener_init_and_register(struct pubsub_listener_s* listener, struct pubsub_topic_s* topic, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx);
 
 // - Sets the handler callback and context variable that it will be called with. Note that the handler callback will not be called
 //   until the listener's owner thread calls one of the following APIs:
 //     - pubsub_listener_handle_until_timeout
 //     - pubsub_multiple_listener_handle_until_timeout
-// - Note that while handler_cb is executing, publishers on the listener's topic group can be blocked if they need to deallocate
-//   the message that the handler is handling. This problem can be mitigated by minimizing blocking, allocating more memory to the
-//   topic group, or using a separate topic group.
+// - Note that the message is pinned while handler_cb is executing, so publishers on the listener's topic group that need to
+//   deallocate it fail instead of waiting for the handler. This problem can be mitigated by minimizing blocking, allocating more
+//   memory to the topic group, or using a separate topic group.
 void pubsub_listener_set_handler_cb(struct pubsub_listener_s* listener, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx);
 
+// - Sets which messages the listener handles. Rejected messages are skipped without waking the listener's thread.
+// - A message is accepted if filter_cb(size, msg, filter_cb_ctx) returns true, at least min_interval has elapsed between the
+//   publish times of the previously accepted message and this one, and it is the decimation-th message to pass the previous two
+//   checks. filter_cb may be NULL, decimation may be 0 or 1, and min_interval may be 0 to disable the respective check.
+// - filter_cb is called with the system locked, either by the publisher or by the listener's thread, and must be short and
+//   must not block.
+void pubsub_listener_set_filter(struct pubsub_listener_s* listener, pubsub_message_filter_func_ptr filter_cb, void* filter_cb_ctx, uint32_t decimation, systime_t min_interval);
+
+// - Sets a batch handler callback, which replaces the listener's handler callback. Instead of being called once per message, the
+//   batch handler is called once with all immediately available messages and retrieves them in order with pubsub_batch_next,
+//   so that a burst of messages is handled with one wakeup and one mutex lock.
+// - A batch ends after max_batch_size messages, or once time_budget has elapsed since the batch began. max_batch_size may be 0
+//   for no limit, and time_budget may be TIME_INFINITE for no limit. Messages left in the batch are handled by the next batch.
+// - Pass NULL as batch_handler_cb to go back to calling the handler callback once per message.
+// - The message returned most recently by pubsub_batch_next is pinned until the next call, in the same way as a message being
+//   handled by a handler callback.
+void pubsub_listener_set_batch_handler_cb(struct pubsub_listener_s* listener, pubsub_batch_handler_func_ptr batch_handler_cb, void* handler_cb_ctx, size_t max_batch_size, systime_t time_budget);
+
+// - Returns the next message in the batch and sets *msg_size to its size, or returns NULL once the batch has ended.
+// - The message returned by the previous call is released, and must not be accessed afterwards.
+const void* pubsub_batch_next(struct pubsub_batch_s* batch, size_t* msg_size);
+
 // - Allocates a message on topic topic of size size, calls writer_cb(size, msg, ctx) to populate it, and publishes it.
-void pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
+// - Returns false if the message was dropped, because the topic has no listeners, the message cannot fit in the topic group's
+//   memory pool, or the oldest message in the topic group is pinned.
+bool pubsub_publish_message(struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
 void pubsub_copy_writer_func(size_t msg_size, void* msg, void* ctx);
 
+// - Allocates a message on topic topic of size size and returns a pointer to its payload, so that the caller can serialize
+//   directly into the topic group's memory pool. The message is published by pubsub_publish_commit.
+// - Returns NULL if the topic has no listeners, the message cannot fit in the topic group's memory pool, or the oldest message
+//   in the topic group is pinned.
+// - On success, the system is left locked until pubsub_publish_commit is called. The caller must populate the message without
+//   blocking and must not call anything other than I-class APIs in between.
+void* pubsub_publish_begin(struct pubsub_topic_s* topic, size_t size);
+
+// - Links a message returned by pubsub_publish_begin into its topic, wakes listener threads and unlocks the system.
+void pubsub_publish_commit(void* msg);
+
+// - Pins a message, so that it is not deallocated until it is unpinned. Pins are counted, and each pin must be matched by an unpin.
+// - msg must be a message passed to a handler callback or returned by pubsub_batch_next, and must be pinned before the handler
+//   callback returns or pubsub_batch_next is called again. The message can then be used after the handler returns, from any thread.
+// - While a message is pinned, publishers on its topic group fail once they need to deallocate it, so pins should be short-lived.
+void pubsub_message_pin_I(const void* msg);
+void pubsub_message_pin(const void* msg);
+void pubsub_message_unpin_I(const void* msg);
+void pubsub_message_unpin(const void* msg);
+
 // - Unregisters a listener from its topic.
 void pubsub_listener_unregister(struct pubsub_listener_s* listener);
 
 // - Resets a listener to a state of no messages pending.
 void pubsub_listener_reset(struct pubsub_listener_s* listener);
 
-// - Handles the first message that becomes available to listener using the listener's handler_cb
+// - Handles the first message that becomes available to listener using the listener's handler_cb, or a batch of messages if the
+//   listener has a batch_handler_cb.
 // - Returns true if message has been handled, false if timeout has elapsed.
 bool pubsub_listener_handle_one_timeout(struct pubsub_listener_s* listener, systime_t timeout);
 
-// - Handles the first message that becomes available to any listener in the listeners array using the listener's handler_cb.
+// - Handles the first message that becomes available to any listener in the listeners array using the listener's handler_cb, or a
+//   batch of messages if the listener has a batch_handler_cb.
 // - Returns true if message has been handled, false if timeout has elapsed.
 bool pubsub_multiple_listener_handle_one_timeout(size_t num_listeners, struct pubsub_listener_s** listeners, systime_t timeout);
 
@@ -115,4 +298,57 @@ void pubsub_multiple_listener_handle_until_timeout(size_t num_listeners, struct
 //   a pointer to the listener with the new message.
 void pubsub_listener_set_waiting_thread_reference(struct pubsub_listener_s* listener, thread_reference_t* trpp);
 
+// - Whenever a message is published that leaves the listener with messages to handle, ready_mask is ORed into *ready_mask_ptr
+//   before the waiting thread is woken. This lets a thread waiting on many listeners find the ones with messages without
+//   checking each of them. *ready_mask_ptr is only written with the system locked.
+void pubsub_listener_set_ready_mask(struct pubsub_listener_s* listener, uint32_t* ready_mask_ptr, uint32_t ready_mask);
+
+bool pubsub_listener_has_message_I(struct pubsub_listener_s* listener);
 bool pubsub_listener_has_message(struct pubsub_listener_s* listener);
+
+// - Returns false if the listener has no message to handle. Otherwise, stores the time the next message it will handle was
+//   published in publish_systime.
+bool pubsub_listener_get_next_message_publish_systime_I(struct pubsub_listener_s* listener, systime_t* publish_systime);
+
+// - Iterates over all topic groups or all topics, in order of creation. Pass a pointer to NULL to get the first item.
+// - Returns false once there are no more items.
+bool pubsub_iterate_topic_groups(struct pubsub_topic_group_s** topic_group_ptr);
+bool pubsub_iterate_topics(struct pubsub_topic_s** topic_ptr);
+
+// - Iterates over the listeners registered on a topic. Pass a pointer to NULL to get the first listener.
+bool pubsub_topic_iterate_listeners(struct pubsub_topic_s* topic, struct pubsub_listener_s** listener_ptr);
+
+#if PUBSUB_STATS_ENABLED
+// - Statistics are only collected when PUBSUB_STATS_ENABLED is TRUE.
+// - Copies a consistent snapshot of the object's statistics into ret. If reset is true, counters are cleared after they are
+//   copied, so that successive calls return per-interval counts. Gauges (listener backlog) are not cleared, and high-water
+//   marks are reset to their current value.
+// - Topic evictions_caused counts messages evicted to make room for messages on that topic, and evictions_suffered counts
+//   messages on that topic evicted to make room for any message. Whether an evicted message had been handled shows up in
+//   listener misses, which include messages deleted before the listener reached them. Taking a listener's statistics does not
+//   move the listener or run its filter.
+void pubsub_topic_get_stats(struct pubsub_topic_s* topic, struct pubsub_topic_stats_s* ret, bool reset);
+void pubsub_topic_group_get_stats(struct pubsub_topic_group_s* topic_group, struct pubsub_topic_group_stats_s* ret, bool reset);
+void pubsub_listener_get_stats(struct pubsub_listener_s* listener, struct pubsub_listener_stats_s* ret, bool reset);
+#endif
+
+// - Sample topics hold only the newest message published on them, in a double-buffered slot protected by a sequence counter.
+//   They do not use a topic group and do not support listeners. Instead, any thread can read a consistent copy of the newest
+//   message at any time without blocking.
+// - memory must be at least PUBSUB_SAMPLE_TOPIC_MEMORY_SIZE(msg_max_size) bytes and suitably aligned.
+void pubsub_init_sample_topic(struct pubsub_sample_topic_s* topic, size_t msg_max_size, void* memory);
+
+// - Overwrites the sample topic's message with a message of size size populated by writer_cb(size, msg, ctx).
+// - Publishers are serialized with the system lock, so writer_cb must not block.
+// - Returns false if size exceeds the topic's maximum message size.
+bool pubsub_sample_publish_I(struct pubsub_sample_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
+bool pubsub_sample_publish(struct pubsub_sample_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
+
+// - Copies the newest message on the sample topic into buf, truncated to buf_size, without locking.
+// - Returns the number of bytes copied, or 0 if nothing has been published yet.
+// - If seq is not NULL, it receives the sequence number of the copied message. Sequence numbers increase by one per publish.
+size_t pubsub_sample_read(struct pubsub_sample_topic_s* topic, void* buf, size_t buf_size, uint32_t* seq);
+
+// - Returns the sequence number of the newest message on the sample topic, or 0 if nothing has been published yet. Polling
+//   consumers can compare this against the last sequence number they read to check for new data without copying it.
+uint32_t pubsub_sample_get_seq(struct pubsub_sample_topic_s* topic);
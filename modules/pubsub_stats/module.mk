@@ -0,0 +1 @@
+UDEFS += -DPUBSUB_STATS_ENABLED=TRUE
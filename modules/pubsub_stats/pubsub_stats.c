@@ -0,0 +1,106 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/ctor.h>
+#include <ch.h>
+#include <modules/pubsub/pubsub.h>
+#include <modules/worker_thread/worker_thread.h>
+#include <modules/uavcan_debug/uavcan_debug.h>
+#include <common/helpers.h>
+
+#if !PUBSUB_STATS_ENABLED
+#error pubsub_stats requires PUBSUB_STATS_ENABLED.
+#endif
+
+#ifndef PUBSUB_STATS_WORKER_THREAD
+#error Please define PUBSUB_STATS_WORKER_THREAD in framework_conf.h.
+#endif
+
+#ifndef PUBSUB_STATS_PRINT_INTERVAL_S
+#define PUBSUB_STATS_PRINT_INTERVAL_S 10
+#endif
+
+#define WT PUBSUB_STATS_WORKER_THREAD
+WORKER_THREAD_DECLARE_EXTERN(WT)
+
+static struct worker_thread_timer_task_s stats_print_task;
+static void stats_print_task_func(struct worker_thread_timer_task_s* task);
+
+RUN_AFTER(WORKER_THREADS_INIT) {
+    worker_thread_add_timer_task(&WT, &stats_print_task, stats_print_task_func, NULL, S2ST(PUBSUB_STATS_PRINT_INTERVAL_S), true);
+    worker_thread_timer_task_set_slack(&stats_print_task, S2ST(1));
+}
+
+static void print_topic_group_stats(unsigned group_idx, struct pubsub_topic_group_s* topic_group) {
+    struct pubsub_topic_group_stats_s stats;
+    pubsub_topic_group_get_stats(topic_group, &stats, true);
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "g%u: hwm %u/%u evict %u fail %u pin %u", group_idx, (unsigned)stats.used_high_water, (unsigned)topic_group->allocator.memory_pool_size, (unsigned)stats.evictions, (unsigned)stats.allocation_failures, (unsigned)stats.pin_failures);
+}
+
+static void print_listener_stats(unsigned topic_idx, unsigned listener_idx, struct pubsub_listener_s* listener) {
+    struct pubsub_listener_stats_s stats;
+    pubsub_listener_get_stats(listener, &stats, true);
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "t%u l%u: n %u filt %u miss %u blog %u/%u", topic_idx, listener_idx, (unsigned)stats.handled_count, (unsigned)stats.filtered_count, (unsigned)stats.misses, (unsigned)stats.backlog, (unsigned)stats.backlog_high_water);
+
+    // Latency histogram, one count per log2 bin, starting at the first non-empty bin
+    char buf[80];
+    uint32_t first_bin_min = format_log2_histogram(buf, sizeof(buf), stats.latency_histogram, PUBSUB_STATS_LATENCY_HISTOGRAM_BINS);
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "t%u l%u lat>=%u:%s", topic_idx, listener_idx, (unsigned)first_bin_min, buf);
+}
+
+static void print_topic_stats(unsigned topic_idx, struct pubsub_topic_s* topic) {
+    struct pubsub_topic_stats_s stats;
+    pubsub_topic_get_stats(topic, &stats, true);
+
+    unsigned group_idx = 0;
+    struct pubsub_topic_group_s* topic_group = NULL;
+    while (pubsub_iterate_topic_groups(&topic_group) && topic_group != topic->group) {
+        group_idx++;
+    }
+
+    const char* name = pubsub_topic_get_name(topic);
+    if (name) {
+        uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "t%u: %s", topic_idx, name);
+    } else {
+        uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "t%u: id 0x%08x", topic_idx, (unsigned)pubsub_topic_get_id(topic));
+    }
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "pubsub", "t%u g%u: n %u b %u fail %u ev %u/%u", topic_idx, group_idx, (unsigned)stats.publish_count, (unsigned)stats.publish_bytes, (unsigned)stats.publish_failures, (unsigned)stats.evictions_caused, (unsigned)stats.evictions_suffered);
+
+    unsigned listener_idx = 0;
+    struct pubsub_listener_s* listener = NULL;
+    while (pubsub_topic_iterate_listeners(topic, &listener)) {
+        print_listener_stats(topic_idx, listener_idx++, listener);
+    }
+}
+
+static void stats_print_task_func(struct worker_thread_timer_task_s* task) {
+    (void)task;
+
+    unsigned group_idx = 0;
+    struct pubsub_topic_group_s* topic_group = NULL;
+    while (pubsub_iterate_topic_groups(&topic_group)) {
+        print_topic_group_stats(group_idx++, topic_group);
+    }
+
+    unsigned topic_idx = 0;
+    struct pubsub_topic_s* topic = NULL;
+    while (pubsub_iterate_topics(&topic)) {
+        print_topic_stats(topic_idx++, topic);
+    }
+}
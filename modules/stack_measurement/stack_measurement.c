@@ -30,6 +30,7 @@ static void stack_print_task_func(struct worker_thread_timer_task_s* task);
 
 RUN_AFTER(WORKER_THREADS_INIT) {
     worker_thread_add_timer_task(&WT, &stack_print_task, stack_print_task_func, NULL, LL_S2ST(5), false);
+    worker_thread_timer_task_set_slack(&stack_print_task, S2ST(1));
 }
 
 extern uint8_t __process_stack_base__;
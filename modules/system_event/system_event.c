@@ -5,9 +5,13 @@
 struct pubsub_topic_s system_event_topic;
 
 RUN_ON(PUBSUB_TOPIC_INIT) {
-    pubsub_init_topic(&system_event_topic, NULL);
+    pubsub_init_named_topic(&system_event_topic, NULL, "system_event");
 }
 
 void system_event_publish(enum system_event_t event) {
-    pubsub_publish_message(&system_event_topic, sizeof(event), pubsub_copy_writer_func, &event);
+    enum system_event_t* msg = pubsub_publish_begin(&system_event_topic, sizeof(enum system_event_t));
+    if (msg) {
+        *msg = event;
+        pubsub_publish_commit(msg);
+    }
 }
@@ -23,14 +23,14 @@ struct timer_input_capture_publisher_topic_s {
     struct timer_input_capture_publisher_topic_s* next;
 };
 
-static struct worker_thread_publisher_task_s publisher_task;
+static struct worker_thread_channel_task_s channel_task;
 
 struct timer_input_capture_msg_s timer_input_capture_msg;
 static ICUDriver icu_T1;
 struct timer_input_capture_publisher_topic_s* irq_topic_T1 = NULL;
 
 RUN_ON(PUBSUB_TOPIC_INIT) {
-    worker_thread_add_publisher_task(&WT, &publisher_task, sizeof(struct timer_input_capture_msg_s), TIMER_INPUT_CAPTURE_PUBLISHER_QUEUE_DEPTH);
+    worker_thread_add_channel_task(&WT, &channel_task, sizeof(struct timer_input_capture_msg_s), TIMER_INPUT_CAPTURE_PUBLISHER_QUEUE_DEPTH, NULL, NULL);
 }
 
 MEMORYPOOL_DECL(timer_input_capture_publisher_topic_list_pool, sizeof(struct timer_input_capture_publisher_topic_s), chCoreAllocAlignedI);
@@ -47,7 +47,7 @@ void icuperiodcb(ICUDriver *icup) {
         timer_input_capture_msg.period = icuGetPeriodX(icup);
         timer_input_capture_msg.width  = icuGetWidthX(icup);
         timer_input_capture_msg.timestamp = chVTGetSystemTimeX();
-        worker_thread_publisher_task_publish_I(&publisher_task, irq_topic_T1->topic, sizeof(struct timer_input_capture_msg_s), pubsub_copy_writer_func, &timer_input_capture_msg);
+        worker_thread_channel_task_publish_I(&channel_task, irq_topic_T1->topic, sizeof(struct timer_input_capture_msg_s), pubsub_copy_writer_func, &timer_input_capture_msg);
         chSysUnlockFromISR();
     }
 }
@@ -31,6 +31,14 @@
 #define UAVCAN_TRANSFER_ID_MAP_WORKING_AREA_SIZE 128
 #endif
 
+#ifndef UAVCAN_RX_BATCH_MAX_SIZE
+#define UAVCAN_RX_BATCH_MAX_SIZE 16
+#endif
+
+#ifndef UAVCAN_RX_BATCH_TIME_BUDGET
+#define UAVCAN_RX_BATCH_TIME_BUDGET MS2ST(2)
+#endif
+
 #ifndef UAVCAN_RX_WORKER_THREAD
 #error Please define UAVCAN_RX_WORKER_THREAD in framework_conf.h.
 #endif
@@ -51,9 +59,15 @@ struct transfer_id_map_s {
     uint16_t head;
 };
 
+// Receive topics are registered in the pubsub topic registry under this ID, so that received transfers are matched to their
+// topic without scanning a list
+#define UAVCAN_RX_TOPIC_ID(IDX, TRANSFER_TYPE, DATA_TYPE_ID) (0x55000000UL | ((uint32_t)(IDX)<<18) | ((uint32_t)(TRANSFER_TYPE)<<16) | (uint32_t)(DATA_TYPE_ID))
+
 struct uavcan_rx_list_item_s {
     const struct uavcan_message_descriptor_s* msg_descriptor;
     struct pubsub_topic_s topic;
+    struct can_filter_s can_filter;
+    bool can_filter_added;
     struct uavcan_rx_list_item_s* next;
 };
 
@@ -71,12 +85,16 @@ struct uavcan_instance_s {
     struct uavcan_instance_s* next;
 };
 
-static void uavcan_can_rx_handler(size_t msg_size, const void* buf, void* ctx);
+static void uavcan_can_rx_handler(struct pubsub_batch_s* batch, void* ctx);
 
 static struct uavcan_instance_s* uavcan_get_instance(uint8_t idx);
 static uint8_t uavcan_get_idx(struct uavcan_instance_s* instance_arg);
 static void uavcan_init(uint8_t can_dev_idx);
+static uint8_t _uavcan_get_node_id(struct uavcan_instance_s* instance);
 static void _uavcan_set_node_id(struct uavcan_instance_s* instance, uint8_t node_id);
+static uint16_t _uavcan_get_message_data_type_id(struct uavcan_instance_s* instance, const struct uavcan_message_descriptor_s* msg_descriptor);
+static void uavcan_update_rx_filter(struct uavcan_instance_s* instance, struct uavcan_rx_list_item_s* rx_list_item, uint8_t node_id);
+static void uavcan_update_rx_filters(struct uavcan_instance_s* instance);
 
 static bool uavcan_should_accept_transfer(const CanardInstance* canard, uint64_t* out_data_type_signature, uint16_t data_type_id, CanardTransferType transfer_type, uint8_t source_node_id);
 static void uavcan_on_transfer_rx(CanardInstance* canard, CanardRxTransfer* transfer);
@@ -87,6 +105,7 @@ static void uavcan_transfer_id_map_init(struct transfer_id_map_s* map, size_t ma
 static uint8_t* uavcan_transfer_id_map_retrieve(struct transfer_id_map_s* map, bool service_not_message, uint16_t transfer_id, uint8_t dest_node_id);
 
 MEMORYPOOL_DECL(rx_list_pool, sizeof(struct uavcan_rx_list_item_s), chCoreAllocAlignedI);
+MUTEX_DECL(rx_list_mutex);
 
 static void stale_transfer_cleanup_task_func(struct worker_thread_timer_task_s* task);
 static struct worker_thread_timer_task_s stale_transfer_cleanup_task;
@@ -122,7 +141,7 @@ static void uavcan_init(uint8_t can_dev_idx) {
     canardInit(&instance->canard, instance->canard_memory_pool, UAVCAN_CANARD_MEMORY_POOL_SIZE, uavcan_on_transfer_rx, uavcan_should_accept_transfer, instance);
     struct pubsub_topic_s* can_rx_topic = can_get_rx_topic(instance->can_instance);
     if (!can_rx_topic) { goto fail; }
-    worker_thread_add_listener_task(&WT_RX, &instance->rx_listener_task, can_rx_topic, uavcan_can_rx_handler, instance); // TODO configurable thread
+    worker_thread_add_batch_listener_task(&WT_RX, &instance->rx_listener_task, can_rx_topic, uavcan_can_rx_handler, instance, UAVCAN_RX_BATCH_MAX_SIZE, UAVCAN_RX_BATCH_TIME_BUDGET); // TODO configurable thread
 
     can_set_auto_retransmit_mode(instance->can_instance, false);
 
@@ -166,6 +185,7 @@ void uavcan_forget_nodeid(uint8_t uavcan_idx) {
     if (!(uavcan_instance = uavcan_get_instance(uavcan_idx))) { goto fail; }
     CanardInstance* canard_instance= &uavcan_instance->canard;
     canardForgetLocalNodeID(canard_instance);
+    uavcan_update_rx_filters(uavcan_instance);
     return;
 
 fail:
@@ -186,39 +206,49 @@ static bool uavcan_iterate_instances(struct uavcan_instance_s** instance_ptr) {
     return *instance_ptr != NULL;
 }
 
+static struct uavcan_rx_list_item_s* uavcan_get_rx_list_item(struct uavcan_instance_s* instance, CanardTransferType transfer_type, uint16_t data_type_id) {
+    struct pubsub_topic_s* topic = pubsub_find_topic(UAVCAN_RX_TOPIC_ID(instance->idx, transfer_type, data_type_id));
+    if (!topic) {
+        return NULL;
+    }
+
+    return (struct uavcan_rx_list_item_s*)((uint8_t*)topic - offsetof(struct uavcan_rx_list_item_s, topic));
+}
+
 static struct pubsub_topic_s* _uavcan_get_message_topic(struct uavcan_instance_s* instance, const struct uavcan_message_descriptor_s* msg_descriptor) {
-    if (!instance) {
+    if (!instance || !msg_descriptor) {
         return NULL;
     }
 
-    chSysLock();
+    chMtxLock(&rx_list_mutex);
 
     // attempt to find existing item in receive list
-    struct uavcan_rx_list_item_s* rx_list_item = instance->rx_list_head;
-    while (rx_list_item && rx_list_item->msg_descriptor != msg_descriptor) {
-        rx_list_item = rx_list_item->next;
-    }
+    uint16_t data_type_id = _uavcan_get_message_data_type_id(instance, msg_descriptor);
+    struct uavcan_rx_list_item_s* rx_list_item = uavcan_get_rx_list_item(instance, msg_descriptor->transfer_type, data_type_id);
 
     if (rx_list_item) {
-        chSysUnlock();
-        return &rx_list_item->topic;
+        chMtxUnlock(&rx_list_mutex);
+        // A different descriptor with the same data type ID would be ambiguous
+        return rx_list_item->msg_descriptor == msg_descriptor ? &rx_list_item->topic : NULL;
     }
 
     // create new item in receive list
-    rx_list_item = chPoolAllocI(&rx_list_pool);
+    rx_list_item = chPoolAlloc(&rx_list_pool);
     if (!rx_list_item) {
-        chSysUnlock();
+        chMtxUnlock(&rx_list_mutex);
         return NULL;
     }
 
-    // populate it
+    // populate it and register its topic
     rx_list_item->msg_descriptor = msg_descriptor;
     pubsub_init_topic(&rx_list_item->topic, NULL);
-
-    // append it
+    pubsub_register_topic(&rx_list_item->topic, UAVCAN_RX_TOPIC_ID(instance->idx, msg_descriptor->transfer_type, data_type_id), NULL);
+    rx_list_item->can_filter_added = false;
     LINKED_LIST_APPEND(struct uavcan_rx_list_item_s, instance->rx_list_head, rx_list_item);
+    uavcan_update_rx_filter(instance, rx_list_item, _uavcan_get_node_id(instance));
+    can_commit_filters(instance->can_instance);
 
-    chSysUnlock();
+    chMtxUnlock(&rx_list_mutex);
 
     return &rx_list_item->topic;
 }
@@ -241,6 +271,47 @@ uint16_t uavcan_get_message_data_type_id(uint8_t uavcan_idx, const struct uavcan
     return _uavcan_get_message_data_type_id(uavcan_get_instance(uavcan_idx), msg_descriptor);
 }
 
+// - Hardware acceptance filter for one receive list item, in UAVCAN v0 CAN ID layout. Priority and source node are left
+//   out of the mask. Service transfers are only accepted when addressed to this node, so there are none without a node ID.
+static void uavcan_update_rx_filter(struct uavcan_instance_s* instance, struct uavcan_rx_list_item_s* rx_list_item, uint8_t node_id) {
+    uint16_t data_type_id = _uavcan_get_message_data_type_id(instance, rx_list_item->msg_descriptor);
+    struct can_filter_s* filter = &rx_list_item->can_filter;
+
+    if (rx_list_item->can_filter_added) {
+        can_remove_filter(instance->can_instance, filter);
+        rx_list_item->can_filter_added = false;
+    }
+
+    filter->IDE = true;
+    if (rx_list_item->msg_descriptor->transfer_type == CanardTransferTypeBroadcast) {
+        filter->id = (uint32_t)data_type_id << 8;
+        filter->mask = (0xFFFFUL << 8) | (1UL << 7);
+    } else if (node_id != 0) {
+        bool request_not_response = rx_list_item->msg_descriptor->transfer_type == CanardTransferTypeRequest;
+        filter->id = ((uint32_t)(data_type_id & 0xFF) << 16) | ((uint32_t)request_not_response << 15) | ((uint32_t)node_id << 8) | (1UL << 7);
+        filter->mask = (0xFFUL << 16) | (1UL << 15) | (0x7FUL << 8) | (1UL << 7);
+    } else {
+        return;
+    }
+
+    can_add_filter(instance->can_instance, filter);
+    rx_list_item->can_filter_added = true;
+}
+
+static void uavcan_update_rx_filters(struct uavcan_instance_s* instance) {
+    uint8_t node_id = _uavcan_get_node_id(instance);
+
+    chMtxLock(&rx_list_mutex);
+    for (struct uavcan_rx_list_item_s* rx_list_item = instance->rx_list_head; rx_list_item != NULL; rx_list_item = rx_list_item->next) {
+        uavcan_update_rx_filter(instance, rx_list_item, node_id);
+    }
+    // Nothing has been subscribed yet, and committing now would shut out every frame
+    if (instance->rx_list_head) {
+        can_commit_filters(instance->can_instance);
+    }
+    chMtxUnlock(&rx_list_mutex);
+}
+
 static uint8_t _uavcan_get_node_id(struct uavcan_instance_s* instance) {
     if (!instance) {
         return 0;
@@ -265,6 +336,8 @@ static void _uavcan_set_node_id(struct uavcan_instance_s* instance, uint8_t node
     chSysLock();
     canardSetLocalNodeID(&instance->canard, node_id);
     chSysUnlock();
+
+    uavcan_update_rx_filters(instance);
 }
 
 void uavcan_set_node_id(uint8_t uavcan_idx, uint8_t node_id) {
@@ -492,16 +565,17 @@ bool uavcan_respond(uint8_t uavcan_idx, const struct uavcan_deserialized_message
     return _uavcan_send(instance, msg_descriptor, data_type_id, priority, transfer_id, dest_node_id, msg_data);
 }
 
-static void uavcan_can_rx_handler(size_t msg_size, const void* msg, void* ctx) {
-    (void) msg_size;
+static void uavcan_can_rx_handler(struct pubsub_batch_s* batch, void* ctx) {
     struct uavcan_instance_s* instance = ctx;
 
-    const struct can_rx_frame_s* frame = msg;
+    const struct can_rx_frame_s* frame;
+    while ((frame = pubsub_batch_next(batch, NULL))) {
+        // Copy the frame out before handling it, since completing a transfer publishes to the same topic group
+        CanardCANFrame canard_frame = convert_can_frame_to_CanardCANFrame(&frame->content);
 
-    CanardCANFrame canard_frame = convert_can_frame_to_CanardCANFrame(&frame->content);
-
-    uint64_t timestamp = micros64();
-    canardHandleRxFrame(&instance->canard, &canard_frame, timestamp);
+        uint64_t timestamp = micros64();
+        canardHandleRxFrame(&instance->canard, &canard_frame, timestamp);
+    }
 }
 
 static void stale_transfer_cleanup_task_func(struct worker_thread_timer_task_s* task) {
@@ -564,25 +638,6 @@ static CanardCANFrame convert_can_frame_to_CanardCANFrame(const struct can_frame
     return ret;
 }
 
-struct uavcan_message_writer_func_args {
-    uint8_t uavcan_idx;
-    CanardRxTransfer* transfer;
-    const struct uavcan_message_descriptor_s* const descriptor;
-};
-
-static void uavcan_message_writer_func(size_t msg_size, void* write_buf, void* ctx) {
-    (void)msg_size;
-    struct uavcan_message_writer_func_args* args = ctx;
-    struct uavcan_deserialized_message_s* deserialized_message = write_buf;
-    deserialized_message->uavcan_idx = args->uavcan_idx;
-    deserialized_message->descriptor = args->descriptor;
-    deserialized_message->data_type_id = args->transfer->data_type_id;
-    deserialized_message->transfer_id = args->transfer->transfer_id;
-    deserialized_message->priority = args->transfer->priority;
-    deserialized_message->source_node_id = args->transfer->source_node_id;
-    args->descriptor->deserializer_func(args->transfer, deserialized_message->msg);
-}
-
 static void uavcan_on_transfer_rx(CanardInstance* canard, CanardRxTransfer* transfer) {
     if (!canard || !transfer) {
         return;
@@ -593,14 +648,21 @@ static void uavcan_on_transfer_rx(CanardInstance* canard, CanardRxTransfer* tran
         return;
     }
 
-    struct uavcan_rx_list_item_s* rx_list_item = instance->rx_list_head;
-    while (rx_list_item) {
-        if (rx_list_item->msg_descriptor->transfer_type == transfer->transfer_type && _uavcan_get_message_data_type_id(instance, rx_list_item->msg_descriptor) == transfer->data_type_id) {
-            struct uavcan_message_writer_func_args writer_args = { instance->idx, transfer, rx_list_item->msg_descriptor };
-            pubsub_publish_message(&rx_list_item->topic, rx_list_item->msg_descriptor->deserialized_size+sizeof(struct uavcan_deserialized_message_s), uavcan_message_writer_func, &writer_args);
-        }
+    struct uavcan_rx_list_item_s* rx_list_item = uavcan_get_rx_list_item(instance, transfer->transfer_type, transfer->data_type_id);
+    if (!rx_list_item) {
+        return;
+    }
 
-        rx_list_item = rx_list_item->next;
+    struct uavcan_deserialized_message_s* deserialized_message = pubsub_publish_begin(&rx_list_item->topic, rx_list_item->msg_descriptor->deserialized_size+sizeof(struct uavcan_deserialized_message_s));
+    if (deserialized_message) {
+        deserialized_message->uavcan_idx = instance->idx;
+        deserialized_message->descriptor = rx_list_item->msg_descriptor;
+        deserialized_message->data_type_id = transfer->data_type_id;
+        deserialized_message->transfer_id = transfer->transfer_id;
+        deserialized_message->priority = transfer->priority;
+        deserialized_message->source_node_id = transfer->source_node_id;
+        rx_list_item->msg_descriptor->deserializer_func(transfer, deserialized_message->msg);
+        pubsub_publish_commit(deserialized_message);
     }
 }
 
@@ -615,17 +677,13 @@ static bool uavcan_should_accept_transfer(const CanardInstance* canard, uint64_t
         return false;
     }
 
-    struct uavcan_rx_list_item_s* rx_list_item = instance->rx_list_head;
-    while (rx_list_item) {
-        if (transfer_type == rx_list_item->msg_descriptor->transfer_type && data_type_id == _uavcan_get_message_data_type_id(instance, rx_list_item->msg_descriptor)) {
-            *out_data_type_signature = rx_list_item->msg_descriptor->data_type_signature;
-            return true;
-        }
-
-        rx_list_item = rx_list_item->next;
+    struct uavcan_rx_list_item_s* rx_list_item = uavcan_get_rx_list_item(instance, transfer_type, data_type_id);
+    if (!rx_list_item) {
+        return false;
     }
 
-    return false;
+    *out_data_type_signature = rx_list_item->msg_descriptor->data_type_signature;
+    return true;
 }
 
 #define UAVCAN_TRANSFER_ID_MAP_MAX_LEN ((1<<7)-1)
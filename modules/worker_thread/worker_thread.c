@@ -1,6 +1,7 @@
 #include "worker_thread.h"
 
 #include <common/helpers.h>
+#include <string.h>
 
 static THD_FUNCTION(worker_thread_func, arg);
 
@@ -8,30 +9,110 @@ static void worker_thread_wake_I(struct worker_thread_s* worker_thread);
 static void worker_thread_wake(struct worker_thread_s* worker_thread);
 static void worker_thread_init_timer_task(struct worker_thread_timer_task_s* task, systime_t timer_begin_systime, systime_t timer_expiration_ticks, bool auto_repeat, timer_task_handler_func_ptr task_func, void* ctx);
 static void worker_thread_insert_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
+static void worker_thread_dequeue_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
+static struct worker_thread_timer_task_s* worker_thread_peek_timer_task_I(struct worker_thread_s* worker_thread);
+static void worker_thread_timer_heap_remove(struct worker_thread_timer_task_s** root, struct worker_thread_timer_task_s* task);
+static struct worker_thread_timer_task_s* worker_thread_timer_heap_get_parent(struct worker_thread_timer_task_s* task);
+static void worker_thread_pop_timer_task_I(struct worker_thread_s* worker_thread);
+static void worker_thread_timer_task_advance_period(struct worker_thread_timer_task_s* task, systime_t tstart_ticks, systime_t tend_ticks);
 static systime_t worker_thread_get_ticks_to_timer_task_I(struct worker_thread_timer_task_s* task, systime_t tnow_ticks);
 static bool worker_thread_timer_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* check_task);
+static struct worker_thread_timer_task_s* worker_thread_timer_queue_iterate_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, bool descend);
+static systime_t worker_thread_get_ticks_to_timer_wakeup_I(struct worker_thread_s* worker_thread, systime_t tnow_ticks);
+static uint32_t worker_thread_count_coalesced_timer_tasks_I(struct worker_thread_s* worker_thread, systime_t tnow_ticks, systime_t earliest_run_time);
 #ifdef MODULE_PUBSUB_ENABLED
 static bool worker_thread_publisher_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* check_task);
-static bool worker_thread_get_any_publisher_task_due_I(struct worker_thread_s* worker_thread);
 static bool worker_thread_listener_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task);
 static bool worker_thread_listener_task_is_registered(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task);
-static bool worker_thread_get_any_listener_task_due_I(struct worker_thread_s* worker_thread);
+static bool worker_thread_channel_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* check_task);
+static void worker_thread_channel_task_drain(struct worker_thread_channel_task_s* task);
+#endif
+static void worker_thread_register_ready_link_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link, enum worker_thread_ready_task_type_t type);
+static void worker_thread_unregister_ready_link_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link);
+static void worker_thread_set_ready_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link);
+static void worker_thread_dispatch_ready_link(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link);
+static void worker_thread_update_ready_bit_priority_I(struct worker_thread_s* worker_thread, uint8_t bit);
+static int8_t worker_thread_select_ready_bit_I(struct worker_thread_s* worker_thread);
+static void worker_thread_dispatch_ready_bit(struct worker_thread_s* worker_thread, uint8_t bit);
+static void worker_thread_run_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, systime_t tnow_ticks);
+static void worker_thread_coroutine_task_run(struct worker_thread_coroutine_task_s* task);
+static size_t worker_thread_deferred_work_next_slot(size_t slot_idx);
+static void worker_thread_deferred_work_drain(struct worker_thread_s* worker_thread);
+#if WORKER_THREAD_TASK_STATS_ENABLED
+static void worker_thread_timer_task_stats_register_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
+static void worker_thread_timer_task_stats_unregister_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
+static void worker_thread_task_stats_record(struct worker_thread_task_stats_s* stats, uint32_t cycles, systime_t lateness);
+#endif
+#if WORKER_THREAD_WATCHDOG_ENABLED
+static void worker_thread_runtime_begin(struct worker_thread_s* worker_thread, const void* task, const void* task_func, systime_t budget_ticks);
+static void worker_thread_runtime_end(struct worker_thread_s* worker_thread);
+static void worker_thread_runtime_begin_ready_link(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link);
 #endif
 
+static struct worker_thread_s* worker_thread_list_head;
+
 void worker_thread_init(struct worker_thread_s* worker_thread, const char* name, tprio_t priority) {
     chDbgCheck(worker_thread != NULL);
 
     worker_thread->name = name;
     worker_thread->priority = priority;
 
+    worker_thread->timer_queue = WORKER_THREAD_TIMER_QUEUE_LIST;
     worker_thread->timer_task_list_head = NULL;
+    worker_thread->timer_task_heap_root = NULL;
+    worker_thread->timer_wakeups_saved = 0;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    worker_thread->timer_task_stats_list_head = NULL;
+#endif
 #ifdef MODULE_PUBSUB_ENABLED
     worker_thread->listener_task_list_head = NULL;
     worker_thread->publisher_task_list_head = NULL;
+    worker_thread->channel_task_list_head = NULL;
+#endif
+    worker_thread->ready_mask = 0;
+    worker_thread->next_ready_bit = 0;
+    for (size_t i=0; i<WORKER_THREAD_READY_BITS; i++) {
+        worker_thread->ready_link_heads[i] = NULL;
+        worker_thread->ready_bit_priority[i] = 0;
+    }
+    worker_thread->ready_scan_start = 0;
+    worker_thread->priority_dispatch_streak = 0;
+    worker_thread->deferred_work_head = 0;
+    worker_thread->deferred_work_tail = 0;
+    worker_thread->deferred_work_overruns = 0;
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    worker_thread->current_task_running = false;
+    worker_thread->runtime_overruns = 0;
+    worker_thread->loop_count = 0;
+    worker_thread->loop_count_checked = 0;
 #endif
 
     worker_thread->thread = NULL;
     worker_thread->suspend_trp = NULL;
+
+    chSysLock();
+    struct worker_thread_s* registered = worker_thread_list_head;
+    while (registered && registered != worker_thread) {
+        registered = registered->next;
+    }
+    if (!registered) {
+        LINKED_LIST_APPEND(struct worker_thread_s, worker_thread_list_head, worker_thread);
+    }
+    chSysUnlock();
+}
+
+bool worker_thread_iterate_worker_threads(struct worker_thread_s** worker_thread_ptr) {
+    if (!worker_thread_ptr) {
+        return false;
+    }
+
+    if (!(*worker_thread_ptr)) {
+        *worker_thread_ptr = worker_thread_list_head;
+    } else {
+        *worker_thread_ptr = (*worker_thread_ptr)->next;
+    }
+
+    return *worker_thread_ptr != NULL;
 }
 
 void worker_thread_start(struct worker_thread_s* worker_thread, size_t stack_size) {
@@ -52,10 +133,46 @@ void worker_thread_start(struct worker_thread_s* worker_thread, size_t stack_siz
     worker_thread->thread = chThdCreate(&thread_descriptor);
 }
 
+void worker_thread_set_timer_queue_I(struct worker_thread_s* worker_thread, enum worker_thread_timer_queue_t timer_queue) {
+    chDbgCheckClassI();
+
+    if (worker_thread->timer_queue == timer_queue) {
+        return;
+    }
+
+    // Pop tasks off the old queue in order, then switch queues and re-insert them
+    struct worker_thread_timer_task_s* moved_list_head = NULL;
+    struct worker_thread_timer_task_s** moved_list_tail = &moved_list_head;
+    struct worker_thread_timer_task_s* task;
+    while ((task = worker_thread_peek_timer_task_I(worker_thread)) != NULL) {
+        worker_thread_pop_timer_task_I(worker_thread);
+        *moved_list_tail = task;
+        moved_list_tail = &task->heap_child;
+    }
+    *moved_list_tail = NULL;
+
+    worker_thread->timer_queue = timer_queue;
+
+    while (moved_list_head) {
+        task = moved_list_head;
+        moved_list_head = task->heap_child;
+        worker_thread_insert_timer_task_I(worker_thread, task);
+    }
+}
+
+void worker_thread_set_timer_queue(struct worker_thread_s* worker_thread, enum worker_thread_timer_queue_t timer_queue) {
+    chSysLock();
+    worker_thread_set_timer_queue_I(worker_thread, timer_queue);
+    chSysUnlock();
+}
+
 static void _worker_thread_add_timer_task_no_wake_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t timer_expiration_ticks, bool auto_repeat) {
     chDbgCheckClassI();
 
     worker_thread_init_timer_task(task, chVTGetSystemTimeX(), timer_expiration_ticks, auto_repeat, task_func, ctx);
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    worker_thread_timer_task_stats_register_I(worker_thread, task);
+#endif
     worker_thread_insert_timer_task_I(worker_thread, task);
 }
 
@@ -77,12 +194,64 @@ void worker_thread_add_timer_task(struct worker_thread_s* worker_thread, struct
     worker_thread_wake(worker_thread);
 }
 
+static void _worker_thread_add_periodic_timer_task_no_wake_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t period_ticks, enum worker_thread_timer_overrun_policy_t overrun_policy) {
+    chDbgCheckClassI();
+    chDbgCheck(period_ticks != TIME_IMMEDIATE && period_ticks != TIME_INFINITE);
+
+    worker_thread_init_timer_task(task, chVTGetSystemTimeX(), period_ticks, true, task_func, ctx);
+    task->periodic = true;
+    task->overrun_policy = overrun_policy;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    worker_thread_timer_task_stats_register_I(worker_thread, task);
+#endif
+    worker_thread_insert_timer_task_I(worker_thread, task);
+}
+
+void worker_thread_add_periodic_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t period_ticks, enum worker_thread_timer_overrun_policy_t overrun_policy) {
+    chDbgCheckClassI();
+
+    _worker_thread_add_periodic_timer_task_no_wake_I(worker_thread, task, task_func, ctx, period_ticks, overrun_policy);
+
+    // Wake worker thread to process tasks
+    worker_thread_wake_I(worker_thread);
+}
+
+void worker_thread_add_periodic_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t period_ticks, enum worker_thread_timer_overrun_policy_t overrun_policy) {
+    chSysLock();
+    _worker_thread_add_periodic_timer_task_no_wake_I(worker_thread, task, task_func, ctx, period_ticks, overrun_policy);
+    chSysUnlock();
+
+    // Wake worker thread to process tasks
+    worker_thread_wake(worker_thread);
+}
+
+void worker_thread_timer_task_set_priority(struct worker_thread_timer_task_s* task, uint8_t priority) {
+    task->priority = priority;
+}
+
+void worker_thread_timer_task_set_slack(struct worker_thread_timer_task_s* task, systime_t slack_ticks) {
+    task->timer_slack_ticks = slack_ticks;
+}
+
+uint32_t worker_thread_get_timer_wakeups_saved(struct worker_thread_s* worker_thread) {
+    return worker_thread->timer_wakeups_saved;
+}
+
+uint32_t worker_thread_timer_task_get_missed_deadlines(struct worker_thread_timer_task_s* task) {
+    return task->missed_deadlines;
+}
+
+systime_t worker_thread_timer_task_get_max_lateness(struct worker_thread_timer_task_s* task) {
+    return task->max_lateness;
+}
+
 static void _worker_thread_timer_task_reschedule_no_wake_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, systime_t timer_expiration_ticks) {
     chDbgCheckClassI();
 
     systime_t t_now = chVTGetSystemTimeX();
 
-    worker_thread_remove_timer_task_I(worker_thread, task);
+    // Only the queue position changes - the task stays registered for stats
+    worker_thread_dequeue_timer_task_I(worker_thread, task);
 
     task->timer_expiration_ticks = timer_expiration_ticks;
     task->timer_begin_systime = t_now;
@@ -109,7 +278,12 @@ void worker_thread_timer_task_reschedule(struct worker_thread_s* worker_thread,
 
 void worker_thread_remove_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
     chDbgCheckClassI();
-    LINKED_LIST_REMOVE(struct worker_thread_timer_task_s, worker_thread->timer_task_list_head, task);
+
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    worker_thread_timer_task_stats_unregister_I(worker_thread, task);
+#endif
+
+    worker_thread_dequeue_timer_task_I(worker_thread, task);
 }
 
 void worker_thread_remove_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
@@ -118,6 +292,25 @@ void worker_thread_remove_timer_task(struct worker_thread_s* worker_thread, stru
     chSysUnlock();
 }
 
+static void worker_thread_dequeue_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
+    chDbgCheckClassI();
+
+    if (!task->queued) {
+        return;
+    }
+
+    switch (worker_thread->timer_queue) {
+        case WORKER_THREAD_TIMER_QUEUE_LIST:
+            LINKED_LIST_REMOVE(struct worker_thread_timer_task_s, worker_thread->timer_task_list_head, task);
+            break;
+        case WORKER_THREAD_TIMER_QUEUE_HEAP:
+            worker_thread_timer_heap_remove(&worker_thread->timer_task_heap_root, task);
+            break;
+    }
+
+    task->queued = false;
+}
+
 void* worker_thread_task_get_user_context(struct worker_thread_timer_task_s* task) {
     if (!task) {
         return NULL;
@@ -132,10 +325,47 @@ void worker_thread_add_listener_task(struct worker_thread_s* worker_thread, stru
 
     pubsub_listener_init_and_register(&task->listener, topic, handler_cb, handler_cb_ctx);
     pubsub_listener_set_waiting_thread_reference(&task->listener, &worker_thread->suspend_trp);
+    task->worker_thread = worker_thread;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    memset(&task->stats, 0, sizeof(task->stats));
+#endif
+
+    chSysLock();
+    worker_thread_register_ready_link_I(worker_thread, &task->ready_link, WORKER_THREAD_READY_LISTENER_TASK);
+    LINKED_LIST_APPEND(struct worker_thread_listener_task_s, worker_thread->listener_task_list_head, task);
+    chSysUnlock();
+    pubsub_listener_set_ready_mask(&task->listener, &worker_thread->ready_mask, 1U<<task->ready_link.bit);
+
+    // Messages published before the ready mask was set did not set the ready bit
+    chSysLock();
+    worker_thread_set_ready_I(worker_thread, &task->ready_link);
+    chSysUnlock();
+
+    // Wake worker thread to process tasks
+    worker_thread_wake(worker_thread);
+}
+
+void worker_thread_add_batch_listener_task(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* task, struct pubsub_topic_s* topic, pubsub_batch_handler_func_ptr batch_handler_cb, void* handler_cb_ctx, size_t max_batch_size, systime_t time_budget) {
+    chDbgCheck(!worker_thread_listener_task_is_registered(worker_thread, task));
+
+    pubsub_listener_init_and_register(&task->listener, topic, NULL, NULL);
+    pubsub_listener_set_batch_handler_cb(&task->listener, batch_handler_cb, handler_cb_ctx, max_batch_size, time_budget);
+    pubsub_listener_set_waiting_thread_reference(&task->listener, &worker_thread->suspend_trp);
+    task->worker_thread = worker_thread;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    memset(&task->stats, 0, sizeof(task->stats));
+#endif
 
     chSysLock();
+    worker_thread_register_ready_link_I(worker_thread, &task->ready_link, WORKER_THREAD_READY_LISTENER_TASK);
     LINKED_LIST_APPEND(struct worker_thread_listener_task_s, worker_thread->listener_task_list_head, task);
     chSysUnlock();
+    pubsub_listener_set_ready_mask(&task->listener, &worker_thread->ready_mask, 1U<<task->ready_link.bit);
+
+    // Messages published before the ready mask was set did not set the ready bit
+    chSysLock();
+    worker_thread_set_ready_I(worker_thread, &task->ready_link);
+    chSysUnlock();
 
     // Wake worker thread to process tasks
     worker_thread_wake(worker_thread);
@@ -145,10 +375,18 @@ void worker_thread_remove_listener_task(struct worker_thread_s* worker_thread, s
     pubsub_listener_unregister(&task->listener);
 
     chSysLock();
+    worker_thread_unregister_ready_link_I(worker_thread, &task->ready_link);
     LINKED_LIST_REMOVE(struct worker_thread_listener_task_s, worker_thread->listener_task_list_head, task);
     chSysUnlock();
 }
 
+void worker_thread_listener_task_set_priority(struct worker_thread_listener_task_s* task, uint8_t priority) {
+    chSysLock();
+    task->ready_link.priority = priority;
+    worker_thread_update_ready_bit_priority_I(task->worker_thread, task->ready_link.bit);
+    chSysUnlock();
+}
+
 void worker_thread_add_publisher_task_I(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* task, size_t msg_max_size, size_t msg_queue_depth) {
     chDbgCheckClassI();
     chDbgCheck(!worker_thread_publisher_task_is_registered_I(worker_thread, task));
@@ -164,6 +402,7 @@ void worker_thread_add_publisher_task_I(struct worker_thread_s* worker_thread, s
         chPoolAddI(&task->pool, chCoreAllocI(mem_block_size));
     }
 
+    worker_thread_register_ready_link_I(worker_thread, &task->ready_link, WORKER_THREAD_READY_PUBLISHER_TASK);
     LINKED_LIST_APPEND(struct worker_thread_publisher_task_s, worker_thread->publisher_task_list_head, task);
 }
 
@@ -175,6 +414,7 @@ void worker_thread_add_publisher_task(struct worker_thread_s* worker_thread, str
 
 void worker_thread_remove_publisher_task(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* task) {
     chSysLock();
+    worker_thread_unregister_ready_link_I(worker_thread, &task->ready_link);
     LINKED_LIST_REMOVE(struct worker_thread_publisher_task_s, worker_thread->publisher_task_list_head, task);
     chSysUnlock();
 }
@@ -201,218 +441,1147 @@ bool worker_thread_publisher_task_publish_I(struct worker_thread_publisher_task_
 
     chMBPostI(&task->mailbox, (msg_t)msg);
 
+    worker_thread_set_ready_I(task->worker_thread, &task->ready_link);
     worker_thread_wake_I(task->worker_thread);
     return true;
 }
-#endif
-
-void worker_thread_takeover(struct worker_thread_s* worker_thread) {
-    chRegSetThreadName(worker_thread->name);
-    chThdSetPriority(worker_thread->priority);
-    worker_thread->thread = chThdGetSelfX();
-
-    while (true) {
-#ifdef MODULE_PUBSUB_ENABLED
-        // Handle publisher tasks
-        {
-            chSysLock();
-            struct worker_thread_publisher_task_s* task = worker_thread->publisher_task_list_head;
-            chSysUnlock();
-            while (task) {
-                struct worker_thread_publisher_msg_s* msg;
-                while (chMBFetch(&task->mailbox, (msg_t*)&msg, TIME_IMMEDIATE) == MSG_OK) {
-                    pubsub_publish_message(msg->topic, msg->size, pubsub_copy_writer_func, msg->data);
-                    chPoolFree(&task->pool, msg);
-                }
-                chSysLock();
-                task = task->next;
-                chSysUnlock();
-            }
-        }
-
-        // Check for immediately available messages on listener tasks, handle one
-        {
-            chSysLock();
-            struct worker_thread_listener_task_s* listener_task = worker_thread->listener_task_list_head;
-            chSysUnlock();
-            while (listener_task) {
-                if (pubsub_listener_handle_one_timeout(&listener_task->listener, TIME_IMMEDIATE)) {
-                    break;
-                }
-                chSysLock();
-                listener_task = listener_task->next;
-                chSysUnlock();
-            }
-        }
-#endif
-        chSysLock();
-        systime_t tnow_ticks = chVTGetSystemTimeX();
-        systime_t ticks_to_next_timer_task = worker_thread_get_ticks_to_timer_task_I(worker_thread->timer_task_list_head, tnow_ticks);
-        if (ticks_to_next_timer_task == TIME_IMMEDIATE) {
-            // Task is due - pop the task off the task list, run it, reschedule if task is auto-repeat
-            struct worker_thread_timer_task_s* next_timer_task = worker_thread->timer_task_list_head;
-            worker_thread->timer_task_list_head = next_timer_task->next;
-
-            chSysUnlock();
-
-            // Perform task
-            next_timer_task->task_func(next_timer_task);
-            next_timer_task->timer_begin_systime = tnow_ticks;
-
-            if (next_timer_task->auto_repeat) {
-                // Re-insert task
-                chSysLock();
-                worker_thread_insert_timer_task_I(worker_thread, next_timer_task);
-                chSysUnlock();
-            }
-        } else {
-#ifdef MODULE_PUBSUB_ENABLED
-            // If a listener task is due, we should not sleep until we've handled it
-            if (worker_thread_get_any_listener_task_due_I(worker_thread)) {
-                chSysUnlock();
-                continue;
-            }
-
-            // If a publisher task is due, we should not sleep until we've handled it
-            if (worker_thread_get_any_publisher_task_due_I(worker_thread)) {
-                chSysUnlock();
-                continue;
-            }
-#endif
-
-            // No task due - go to sleep until there is a task
-            chThdSuspendTimeoutS(&worker_thread->suspend_trp, ticks_to_next_timer_task);
 
-            chSysUnlock();
-        }
+static size_t worker_thread_channel_task_next_slot(struct worker_thread_channel_task_s* task, size_t slot_idx) {
+    slot_idx++;
+    if (slot_idx >= task->num_slots) {
+        slot_idx = 0;
     }
+    return slot_idx;
 }
 
-static THD_FUNCTION(worker_thread_func, arg) {
-    struct worker_thread_s* worker_thread = arg;
-    worker_thread_takeover(worker_thread);
+static struct worker_thread_channel_msg_s* worker_thread_channel_task_get_slot(struct worker_thread_channel_task_s* task, size_t slot_idx) {
+    return (struct worker_thread_channel_msg_s*)&task->slots[slot_idx*task->slot_size];
 }
 
-static void worker_thread_wake_I(struct worker_thread_s* worker_thread) {
+void worker_thread_add_channel_task_I(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task, size_t msg_max_size, size_t msg_queue_depth, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx) {
     chDbgCheckClassI();
+    chDbgCheck(!worker_thread_channel_task_is_registered_I(worker_thread, task));
+
+    const size_t slot_align = __alignof__(struct worker_thread_channel_msg_s);
+
+    task->msg_max_size = msg_max_size;
+    task->slot_size = (sizeof(struct worker_thread_channel_msg_s)+msg_max_size+slot_align-1) & ~(slot_align-1);
+    // One slot is always left empty to tell a full ring from an empty one
+    task->num_slots = msg_queue_depth+1;
+    task->slots = chCoreAllocAlignedI(task->slot_size*task->num_slots, slot_align);
+    chDbgCheck(task->slots != NULL);
+    task->head = 0;
+    task->tail = 0;
+    task->overruns = 0;
+    task->handler_cb = handler_cb;
+    task->handler_cb_ctx = handler_cb_ctx;
+    task->worker_thread = worker_thread;
 
-    chThdResumeI(&worker_thread->suspend_trp, MSG_TIMEOUT);
+    worker_thread_register_ready_link_I(worker_thread, &task->ready_link, WORKER_THREAD_READY_CHANNEL_TASK);
+    LINKED_LIST_APPEND(struct worker_thread_channel_task_s, worker_thread->channel_task_list_head, task);
 }
 
-static void worker_thread_wake(struct worker_thread_s* worker_thread) {
-    chThdResume(&worker_thread->suspend_trp, MSG_TIMEOUT);
+void worker_thread_add_channel_task(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task, size_t msg_max_size, size_t msg_queue_depth, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx) {
+    chSysLock();
+    worker_thread_add_channel_task_I(worker_thread, task, msg_max_size, msg_queue_depth, handler_cb, handler_cb_ctx);
+    chSysUnlock();
 }
 
-static void worker_thread_init_timer_task(struct worker_thread_timer_task_s* task, systime_t timer_begin_systime, systime_t timer_expiration_ticks, bool auto_repeat, timer_task_handler_func_ptr task_func, void* ctx) {
-    task->task_func = task_func;
-    task->ctx = ctx;
-    task->timer_expiration_ticks = timer_expiration_ticks;
-    task->auto_repeat = auto_repeat;
-    task->timer_begin_systime = timer_begin_systime;
+void worker_thread_remove_channel_task(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task) {
+    chSysLock();
+    worker_thread_unregister_ready_link_I(worker_thread, &task->ready_link);
+    LINKED_LIST_REMOVE(struct worker_thread_channel_task_s, worker_thread->channel_task_list_head, task);
+    chSysUnlock();
 }
 
-static bool worker_thread_timer_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* check_task) {
+bool worker_thread_channel_task_publish_I(struct worker_thread_channel_task_s* task, struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx) {
     chDbgCheckClassI();
 
-    struct worker_thread_timer_task_s* task = worker_thread->timer_task_list_head;
-    while (task) {
-        if (task == check_task) {
-            return true;
-        }
-        task = task->next;
+    if (size > task->msg_max_size || (!topic && !task->handler_cb)) {
+        return false;
     }
-    return false;
-}
 
-static void worker_thread_insert_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
-    chDbgCheckClassI();
-    chDbgCheck(!worker_thread_timer_task_is_registered_I(worker_thread, task));
+    size_t head = task->head;
+    size_t next_head = worker_thread_channel_task_next_slot(task, head);
 
-    if (task->timer_expiration_ticks == TIME_INFINITE) {
-        return;
+    if (next_head == task->tail) {
+        // Ring is full
+        task->overruns++;
+        return false;
     }
 
-    systime_t task_run_time = task->timer_begin_systime + task->timer_expiration_ticks;
-    struct worker_thread_timer_task_s** insert_ptr = &worker_thread->timer_task_list_head;
-    while (*insert_ptr && task_run_time - (*insert_ptr)->timer_begin_systime >= (*insert_ptr)->timer_expiration_ticks) {
-        insert_ptr = &(*insert_ptr)->next;
+    struct worker_thread_channel_msg_s* msg = worker_thread_channel_task_get_slot(task, head);
+    msg->topic = topic;
+    msg->size = size;
+
+    if (writer_cb) {
+        writer_cb(size, msg->data, ctx);
     }
-    task->next = *insert_ptr;
-    *insert_ptr = task;
+
+    // Slot contents must be visible before the producer index moves past it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    task->head = next_head;
+
+    worker_thread_set_ready_I(task->worker_thread, &task->ready_link);
+    worker_thread_wake_I(task->worker_thread);
+    return true;
 }
 
-static systime_t worker_thread_get_ticks_to_timer_task_I(struct worker_thread_timer_task_s* task, systime_t tnow_ticks) {
-    chDbgCheckClassI();
+uint32_t worker_thread_channel_task_get_overruns(struct worker_thread_channel_task_s* task) {
+    return task->overruns;
+}
 
-    if (task && task->timer_expiration_ticks != TIME_INFINITE) {
-        systime_t elapsed = tnow_ticks - task->timer_begin_systime;
-        if (elapsed >= task->timer_expiration_ticks) {
-            return TIME_IMMEDIATE;
+static void worker_thread_channel_task_drain(struct worker_thread_channel_task_s* task) {
+    size_t tail = task->tail;
+
+    while (tail != task->head) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        struct worker_thread_channel_msg_s* msg = worker_thread_channel_task_get_slot(task, tail);
+
+        if (task->handler_cb) {
+            task->handler_cb(msg->size, msg->data, task->handler_cb_ctx);
         } else {
-            return task->timer_expiration_ticks - elapsed;
+            void* pubsub_msg = pubsub_publish_begin(msg->topic, msg->size);
+            if (pubsub_msg) {
+                memcpy(pubsub_msg, msg->data, msg->size);
+                pubsub_publish_commit(pubsub_msg);
+            }
         }
-    } else {
-        return TIME_INFINITE;
+
+        tail = worker_thread_channel_task_next_slot(task, tail);
+
+        // Slot must be fully consumed before it is handed back to the producer
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        task->tail = tail;
     }
 }
 
-#ifdef MODULE_PUBSUB_ENABLED
-static bool worker_thread_publisher_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* check_task) {
-    chDbgCheckClassI();
+static bool worker_thread_listener_task_handle_one(struct worker_thread_listener_task_s* task) {
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    systime_t publish_systime;
+    chSysLock();
+    bool has_message = pubsub_listener_get_next_message_publish_systime_I(&task->listener, &publish_systime);
+    chSysUnlock();
 
-    struct worker_thread_publisher_task_s* task = worker_thread->publisher_task_list_head;
-    while (task) {
-        if (task == check_task) {
-            return true;
-        }
-        task = task->next;
+    uint32_t t0 = chSysGetRealtimeCounterX();
+    if (has_message && pubsub_listener_handle_one_timeout(&task->listener, TIME_IMMEDIATE)) {
+        uint32_t t1 = chSysGetRealtimeCounterX();
+        worker_thread_task_stats_record(&task->stats, t1-t0, chVTTimeElapsedSinceX(publish_systime));
+        return true;
     }
     return false;
+#else
+    return pubsub_listener_handle_one_timeout(&task->listener, TIME_IMMEDIATE);
+#endif
 }
 
-static bool worker_thread_get_any_publisher_task_due_I(struct worker_thread_s* worker_thread) {
+#endif
+
+static void worker_thread_register_ready_link_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link, enum worker_thread_ready_task_type_t type) {
     chDbgCheckClassI();
 
-    struct worker_thread_publisher_task_s* task = worker_thread->publisher_task_list_head;
-    while (task) {
-        if (chMBGetUsedCountI(&task->mailbox) != 0) {
-            return true;
-        }
-        task = task->next;
-    }
-    return false;
+    link->type = type;
+    link->priority = 0;
+    link->bit = worker_thread->next_ready_bit;
+    worker_thread->next_ready_bit = (worker_thread->next_ready_bit+1) % WORKER_THREAD_READY_BITS;
+
+    link->next_in_bit = worker_thread->ready_link_heads[link->bit];
+    worker_thread->ready_link_heads[link->bit] = link;
+    worker_thread_update_ready_bit_priority_I(worker_thread, link->bit);
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    link->runtime_budget_ticks = WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET;
+#endif
 }
 
-static bool worker_thread_listener_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task) {
+static void worker_thread_unregister_ready_link_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link) {
     chDbgCheckClassI();
 
-    struct worker_thread_listener_task_s* task = worker_thread->listener_task_list_head;
-    while (task) {
-        if (task == check_task) {
-            return true;
-        }
-        task = task->next;
+    struct worker_thread_ready_link_s** remove_ptr = &worker_thread->ready_link_heads[link->bit];
+    while (*remove_ptr && *remove_ptr != link) {
+        remove_ptr = &(*remove_ptr)->next_in_bit;
     }
-    return false;
+
+    if (*remove_ptr) {
+        *remove_ptr = link->next_in_bit;
+    }
+    worker_thread_update_ready_bit_priority_I(worker_thread, link->bit);
 }
 
-static bool worker_thread_listener_task_is_registered(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task) {
-    chSysLock();
-    bool ret = worker_thread_listener_task_is_registered_I(worker_thread, check_task);
-    chSysUnlock();
-    return ret;
+static void worker_thread_update_ready_bit_priority_I(struct worker_thread_s* worker_thread, uint8_t bit) {
+    chDbgCheckClassI();
+
+    uint8_t priority = 0;
+    for (struct worker_thread_ready_link_s* link = worker_thread->ready_link_heads[bit]; link; link = link->next_in_bit) {
+        priority = MAX(priority, link->priority);
+    }
+    worker_thread->ready_bit_priority[bit] = priority;
 }
 
-static bool worker_thread_get_any_listener_task_due_I(struct worker_thread_s* worker_thread) {
+static void worker_thread_set_ready_I(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link) {
     chDbgCheckClassI();
 
-    struct worker_thread_listener_task_s* listener_task = worker_thread->listener_task_list_head;
-    while (listener_task) {
-        if (pubsub_listener_has_message(&listener_task->listener)) {
-            return true;
+    worker_thread->ready_mask |= 1U<<link->bit;
+}
+
+// - Runs a ready coroutine task, or handles up to WORKER_THREAD_DISPATCH_BUDGET messages (or batches) of a ready task, and sets its ready bit again if it has
+//   more, so that one busy task can not hold up the others.
+static void worker_thread_dispatch_ready_link(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link) {
+    switch (link->type) {
+        case WORKER_THREAD_READY_COROUTINE_TASK: {
+            struct worker_thread_coroutine_task_s* task = (struct worker_thread_coroutine_task_s*)((uint8_t*)link - offsetof(struct worker_thread_coroutine_task_s, ready_link));
+            worker_thread_coroutine_task_run(task);
+            break;
         }
-        listener_task = listener_task->next;
-    }
-    return false;
+#ifdef MODULE_PUBSUB_ENABLED
+        case WORKER_THREAD_READY_LISTENER_TASK: {
+            struct worker_thread_listener_task_s* task = (struct worker_thread_listener_task_s*)((uint8_t*)link - offsetof(struct worker_thread_listener_task_s, ready_link));
+            for (size_t i=0; i<WORKER_THREAD_DISPATCH_BUDGET && worker_thread_listener_task_handle_one(task); i++);
+
+            chSysLock();
+            if (pubsub_listener_has_message_I(&task->listener)) {
+                worker_thread_set_ready_I(worker_thread, link);
+            }
+            chSysUnlock();
+            break;
+        }
+        case WORKER_THREAD_READY_PUBLISHER_TASK: {
+            struct worker_thread_publisher_task_s* task = (struct worker_thread_publisher_task_s*)((uint8_t*)link - offsetof(struct worker_thread_publisher_task_s, ready_link));
+            struct worker_thread_publisher_msg_s* msg;
+            for (size_t i=0; i<WORKER_THREAD_DISPATCH_BUDGET && chMBFetch(&task->mailbox, (msg_t*)&msg, TIME_IMMEDIATE) == MSG_OK; i++) {
+                pubsub_publish_message(msg->topic, msg->size, pubsub_copy_writer_func, msg->data);
+                chPoolFree(&task->pool, msg);
+            }
+
+            chSysLock();
+            if (chMBGetUsedCountI(&task->mailbox) != 0) {
+                worker_thread_set_ready_I(worker_thread, link);
+            }
+            chSysUnlock();
+            break;
+        }
+        case WORKER_THREAD_READY_CHANNEL_TASK: {
+            // The ring is bounded, so it is always drained completely
+            struct worker_thread_channel_task_s* task = (struct worker_thread_channel_task_s*)((uint8_t*)link - offsetof(struct worker_thread_channel_task_s, ready_link));
+            worker_thread_channel_task_drain(task);
+            break;
+        }
+#else
+        default:
+            (void)worker_thread;
+            break;
+#endif
+    }
+}
+
+void worker_thread_add_coroutine_task(struct worker_thread_s* worker_thread, struct worker_thread_coroutine_task_s* task, worker_thread_coroutine_func_ptr func, void* ctx) {
+    task->func = func;
+    task->ctx = ctx;
+    task->resume_point = 0;
+    task->signaled = false;
+    task->sleeping = false;
+    task->worker_thread = worker_thread;
+
+    chSysLock();
+    worker_thread_register_ready_link_I(worker_thread, &task->ready_link, WORKER_THREAD_READY_COROUTINE_TASK);
+    // Run the coroutine up to its first await
+    worker_thread_set_ready_I(worker_thread, &task->ready_link);
+    chSysUnlock();
+
+    // Wake worker thread to process tasks
+    worker_thread_wake(worker_thread);
+}
+
+void worker_thread_remove_coroutine_task(struct worker_thread_s* worker_thread, struct worker_thread_coroutine_task_s* task) {
+    chSysLock();
+    worker_thread_unregister_ready_link_I(worker_thread, &task->ready_link);
+    if (task->sleeping) {
+        worker_thread_remove_timer_task_I(worker_thread, &task->sleep_timer_task);
+        task->sleeping = false;
+    }
+    chSysUnlock();
+}
+
+void worker_thread_coroutine_task_signal_I(struct worker_thread_coroutine_task_s* task) {
+    chDbgCheckClassI();
+
+    task->signaled = true;
+    worker_thread_set_ready_I(task->worker_thread, &task->ready_link);
+    worker_thread_wake_I(task->worker_thread);
+}
+
+void worker_thread_coroutine_task_signal(struct worker_thread_coroutine_task_s* task) {
+    chSysLock();
+    task->signaled = true;
+    worker_thread_set_ready_I(task->worker_thread, &task->ready_link);
+    chSysUnlock();
+
+    // Wake worker thread to process tasks
+    worker_thread_wake(task->worker_thread);
+}
+
+bool worker_thread_coroutine_task_consume_signal(struct worker_thread_coroutine_task_s* task) {
+    chSysLock();
+    bool ret = task->signaled;
+    task->signaled = false;
+    chSysUnlock();
+    return ret;
+}
+
+static void worker_thread_coroutine_task_sleep_timer_func(struct worker_thread_timer_task_s* timer_task) {
+    struct worker_thread_coroutine_task_s* task = worker_thread_task_get_user_context(timer_task);
+
+    task->sleeping = false;
+    worker_thread_coroutine_task_run(task);
+}
+
+void worker_thread_coroutine_task_start_sleep(struct worker_thread_coroutine_task_s* task, systime_t ticks) {
+    task->sleeping = true;
+    worker_thread_add_timer_task(task->worker_thread, &task->sleep_timer_task, worker_thread_coroutine_task_sleep_timer_func, task, ticks, false);
+}
+
+bool worker_thread_coroutine_task_is_sleeping(struct worker_thread_coroutine_task_s* task) {
+    return task->sleeping;
+}
+
+void worker_thread_coroutine_task_yield(struct worker_thread_coroutine_task_s* task) {
+    chSysLock();
+    worker_thread_set_ready_I(task->worker_thread, &task->ready_link);
+    chSysUnlock();
+}
+
+#ifdef MODULE_PUBSUB_ENABLED
+bool worker_thread_coroutine_task_listener_has_message(struct worker_thread_coroutine_task_s* task, struct pubsub_listener_s* listener) {
+    uint32_t ready_mask = 1U<<task->ready_link.bit;
+    if (listener->ready_mask_ptr != &task->worker_thread->ready_mask || listener->ready_mask != ready_mask ||
+        listener->waiting_thread_reference_ptr != &task->worker_thread->suspend_trp) {
+        // Wake the coroutine, and the worker thread if it is suspended, whenever a message is published to the listener
+        pubsub_listener_set_waiting_thread_reference(listener, &task->worker_thread->suspend_trp);
+        pubsub_listener_set_ready_mask(listener, &task->worker_thread->ready_mask, ready_mask);
+    }
+
+    return pubsub_listener_has_message(listener);
+}
+#endif
+
+static void worker_thread_coroutine_task_run(struct worker_thread_coroutine_task_s* task) {
+    if (task->resume_point != WORKER_THREAD_COROUTINE_FINISHED) {
+        task->func(task);
+    }
+}
+
+static size_t worker_thread_deferred_work_next_slot(size_t slot_idx) {
+    slot_idx++;
+    if (slot_idx >= WORKER_THREAD_DEFERRED_WORK_QUEUE_DEPTH+1) {
+        slot_idx = 0;
+    }
+    return slot_idx;
+}
+
+bool worker_thread_defer_I(struct worker_thread_s* worker_thread, worker_thread_deferred_work_func_ptr func, void* arg) {
+    chDbgCheckClassI();
+    chDbgCheck(func != NULL);
+
+    // Producers are serialized by the system lock, so only the worker thread runs concurrently with this
+    size_t head = worker_thread->deferred_work_head;
+    size_t next_head = worker_thread_deferred_work_next_slot(head);
+
+    if (next_head == worker_thread->deferred_work_tail) {
+        // Ring is full
+        worker_thread->deferred_work_overruns++;
+        return false;
+    }
+
+    worker_thread->deferred_work[head].func = func;
+    worker_thread->deferred_work[head].arg = arg;
+
+    // Slot contents must be visible before the producer index moves past it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    worker_thread->deferred_work_head = next_head;
+
+    worker_thread_wake_I(worker_thread);
+    return true;
+}
+
+bool worker_thread_defer(struct worker_thread_s* worker_thread, worker_thread_deferred_work_func_ptr func, void* arg) {
+    chSysLock();
+    bool ret = worker_thread_defer_I(worker_thread, func, arg);
+    chSysUnlock();
+    return ret;
+}
+
+uint32_t worker_thread_get_deferred_work_overruns(struct worker_thread_s* worker_thread) {
+    return worker_thread->deferred_work_overruns;
+}
+
+static void worker_thread_deferred_work_drain(struct worker_thread_s* worker_thread) {
+    size_t tail = worker_thread->deferred_work_tail;
+
+    while (tail != worker_thread->deferred_work_head) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        struct worker_thread_deferred_work_s work = worker_thread->deferred_work[tail];
+
+        // Hand the slot back before running the work, so that it may defer more work
+        tail = worker_thread_deferred_work_next_slot(tail);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        worker_thread->deferred_work_tail = tail;
+
+#if WORKER_THREAD_WATCHDOG_ENABLED
+        worker_thread_runtime_begin(worker_thread, NULL, (const void*)work.func, WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET);
+        work.func(work.arg);
+        worker_thread_runtime_end(worker_thread);
+#else
+        work.func(work.arg);
+#endif
+    }
+}
+
+// - Returns the ready bit whose tasks have the highest priority, or -1 if no bit is ready. Ties go to the first bit at or
+//   after ready_scan_start, so that tasks of equal priority take turns.
+static int8_t worker_thread_select_ready_bit_I(struct worker_thread_s* worker_thread) {
+    chDbgCheckClassI();
+
+    uint32_t ready_mask = worker_thread->ready_mask;
+    if (ready_mask == 0) {
+        return -1;
+    }
+
+    uint8_t start = worker_thread->ready_scan_start;
+    uint32_t rotated_mask = start == 0 ? ready_mask : (ready_mask >> start) | (ready_mask << (WORKER_THREAD_READY_BITS-start));
+
+    int8_t best_bit = -1;
+    while (rotated_mask) {
+        uint8_t bit = (__builtin_ctz(rotated_mask)+start) % WORKER_THREAD_READY_BITS;
+        rotated_mask &= rotated_mask-1;
+
+        if (best_bit < 0 || worker_thread->ready_bit_priority[bit] > worker_thread->ready_bit_priority[best_bit]) {
+            best_bit = bit;
+        }
+    }
+    return best_bit;
+}
+
+static void worker_thread_dispatch_ready_bit(struct worker_thread_s* worker_thread, uint8_t bit) {
+    chSysLock();
+    struct worker_thread_ready_link_s* link = worker_thread->ready_link_heads[bit];
+    chSysUnlock();
+    while (link) {
+#if WORKER_THREAD_WATCHDOG_ENABLED
+        worker_thread_runtime_begin_ready_link(worker_thread, link);
+        worker_thread_dispatch_ready_link(worker_thread, link);
+        worker_thread_runtime_end(worker_thread);
+#else
+        worker_thread_dispatch_ready_link(worker_thread, link);
+#endif
+        chSysLock();
+        link = link->next_in_bit;
+        chSysUnlock();
+    }
+}
+
+// - Runs a timer task that has been popped off the timer queue, and reschedules it if it is auto-repeat.
+static void worker_thread_run_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, systime_t tnow_ticks) {
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    worker_thread_runtime_begin(worker_thread, task, (const void*)task->task_func, task->runtime_budget_ticks);
+#endif
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    systime_t lateness = chVTTimeElapsedSinceX(task->timer_begin_systime + task->timer_expiration_ticks);
+    uint32_t t0 = chSysGetRealtimeCounterX();
+    task->task_func(task);
+    uint32_t t1 = chSysGetRealtimeCounterX();
+    worker_thread_task_stats_record(&task->stats, t1-t0, lateness);
+#else
+    task->task_func(task);
+#endif
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    worker_thread_runtime_end(worker_thread);
+#endif
+
+    // Leave the task alone if it was rescheduled from within its own handler
+    chSysLock();
+    if (!task->queued) {
+        if (task->periodic) {
+            worker_thread_timer_task_advance_period(task, tnow_ticks, chVTGetSystemTimeX());
+        } else {
+            task->timer_begin_systime = tnow_ticks;
+        }
+
+        if (task->auto_repeat) {
+            // Re-insert task
+            worker_thread_insert_timer_task_I(worker_thread, task);
+        }
+    }
+    chSysUnlock();
+}
+
+void worker_thread_takeover(struct worker_thread_s* worker_thread) {
+    chRegSetThreadName(worker_thread->name);
+    chThdSetPriority(worker_thread->priority);
+    worker_thread->thread = chThdGetSelfX();
+
+    while (true) {
+#if WORKER_THREAD_WATCHDOG_ENABLED
+        worker_thread->loop_count++;
+#endif
+
+        worker_thread_deferred_work_drain(worker_thread);
+
+        chSysLock();
+        systime_t tnow_ticks = chVTGetSystemTimeX();
+        struct worker_thread_timer_task_s* next_timer_task = worker_thread_peek_timer_task_I(worker_thread);
+        systime_t ticks_to_next_timer_task = worker_thread_get_ticks_to_timer_task_I(next_timer_task, tnow_ticks);
+        bool timer_task_due = ticks_to_next_timer_task == TIME_IMMEDIATE;
+        uint32_t ready_mask = worker_thread->ready_mask;
+
+        if (ready_mask == 0 && !timer_task_due) {
+            // If deferred work is ready, we should not sleep until we've handled it
+            if (worker_thread->deferred_work_tail != worker_thread->deferred_work_head) {
+                chSysUnlock();
+                continue;
+            }
+
+            // No task due - go to sleep until there is a task, or until the end of the earliest slack window
+            systime_t ticks_to_wakeup = worker_thread_get_ticks_to_timer_wakeup_I(worker_thread, tnow_ticks);
+            msg_t wakeup_msg = chThdSuspendTimeoutS(&worker_thread->suspend_trp, ticks_to_wakeup);
+
+            if (wakeup_msg == MSG_TIMEOUT && ticks_to_wakeup != ticks_to_next_timer_task) {
+                worker_thread->timer_wakeups_saved += worker_thread_count_coalesced_timer_tasks_I(worker_thread, chVTGetSystemTimeX(), tnow_ticks + ticks_to_next_timer_task);
+            }
+
+            chSysUnlock();
+            continue;
+        }
+
+        uint32_t dispatch_mask;
+        bool run_timer_task;
+        if (worker_thread->priority_dispatch_streak >= WORKER_THREAD_PRIORITY_STARVATION_LIMIT) {
+            // Too many dispatches have passed over a ready task - serve every ready task once, regardless of priority
+            dispatch_mask = ready_mask;
+            run_timer_task = timer_task_due;
+            worker_thread->priority_dispatch_streak = 0;
+        } else {
+            // Serve the highest-priority ready task. A due timer task wins a tie.
+            int8_t bit = worker_thread_select_ready_bit_I(worker_thread);
+            if (timer_task_due && (bit < 0 || next_timer_task->priority >= worker_thread->ready_bit_priority[bit])) {
+                dispatch_mask = 0;
+                run_timer_task = true;
+            } else {
+                dispatch_mask = 1U<<bit;
+                run_timer_task = false;
+                worker_thread->ready_scan_start = (bit+1) % WORKER_THREAD_READY_BITS;
+            }
+
+            if ((ready_mask & ~dispatch_mask) != 0 || (timer_task_due && !run_timer_task)) {
+                worker_thread->priority_dispatch_streak++;
+            } else {
+                worker_thread->priority_dispatch_streak = 0;
+            }
+        }
+
+        // Bits that get set again while dispatching are picked up on the next pass
+        worker_thread->ready_mask &= ~dispatch_mask;
+        if (run_timer_task) {
+            worker_thread_pop_timer_task_I(worker_thread);
+        }
+        chSysUnlock();
+
+        while (dispatch_mask) {
+            uint8_t bit = __builtin_ctz(dispatch_mask);
+            dispatch_mask &= dispatch_mask-1;
+            worker_thread_dispatch_ready_bit(worker_thread, bit);
+        }
+
+        if (run_timer_task) {
+            worker_thread_run_timer_task(worker_thread, next_timer_task, tnow_ticks);
+        }
+    }
+}
+
+static THD_FUNCTION(worker_thread_func, arg) {
+    struct worker_thread_s* worker_thread = arg;
+    worker_thread_takeover(worker_thread);
+}
+
+static void worker_thread_wake_I(struct worker_thread_s* worker_thread) {
+    chDbgCheckClassI();
+
+    chThdResumeI(&worker_thread->suspend_trp, MSG_OK);
+}
+
+static void worker_thread_wake(struct worker_thread_s* worker_thread) {
+    chThdResume(&worker_thread->suspend_trp, MSG_OK);
+}
+
+static void worker_thread_init_timer_task(struct worker_thread_timer_task_s* task, systime_t timer_begin_systime, systime_t timer_expiration_ticks, bool auto_repeat, timer_task_handler_func_ptr task_func, void* ctx) {
+    task->task_func = task_func;
+    task->ctx = ctx;
+    task->timer_expiration_ticks = timer_expiration_ticks;
+    task->auto_repeat = auto_repeat;
+    task->timer_begin_systime = timer_begin_systime;
+    task->periodic = false;
+    task->overrun_policy = WORKER_THREAD_TIMER_OVERRUN_SKIP;
+    task->missed_deadlines = 0;
+    task->max_lateness = 0;
+    task->timer_slack_ticks = 0;
+    task->priority = 0;
+    task->queued = false;
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    task->runtime_budget_ticks = WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET;
+#endif
+}
+
+// - Moves a periodic task that started running at tstart_ticks and finished at tend_ticks on to its next release time.
+// - While queued, a periodic task's timer_begin_systime is the release time one period before the one it is queued for.
+static void worker_thread_timer_task_advance_period(struct worker_thread_timer_task_s* task, systime_t tstart_ticks, systime_t tend_ticks) {
+    const systime_t period = task->timer_expiration_ticks;
+    const systime_t release = task->timer_begin_systime + period;
+
+    const systime_t lateness = tstart_ticks - release;
+    task->max_lateness = MAX(task->max_lateness, lateness);
+    if (lateness >= period) {
+        task->missed_deadlines++;
+    }
+
+    // Number of later release times that had already passed by the time the run finished
+    const systime_t passed_releases = (tend_ticks - release) / period;
+
+    switch (task->overrun_policy) {
+        case WORKER_THREAD_TIMER_OVERRUN_SKIP:
+            task->missed_deadlines += passed_releases;
+            task->timer_begin_systime = release + passed_releases*period;
+            break;
+        case WORKER_THREAD_TIMER_OVERRUN_CATCH_UP:
+            task->timer_begin_systime = release;
+            break;
+        case WORKER_THREAD_TIMER_OVERRUN_COALESCE:
+            if (passed_releases > 1) {
+                // The last of the passed releases runs right away, the ones before it are dropped
+                task->missed_deadlines += passed_releases-1;
+                task->timer_begin_systime = release + (passed_releases-1)*period;
+            } else {
+                task->timer_begin_systime = release;
+            }
+            break;
+    }
+}
+
+static bool worker_thread_timer_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* check_task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_timer_task_s* task = NULL;
+    while ((task = worker_thread_timer_queue_iterate_I(worker_thread, task, true)) != NULL) {
+        if (task == check_task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// - Iterates over the queued timer tasks, starting from the earliest. Pass NULL to get the first task.
+// - If descend is false, skips the tasks queued behind the current one, all of which run no earlier than it does. For the list
+//   that ends the iteration, and for the heap it skips the current task's subtree.
+static struct worker_thread_timer_task_s* worker_thread_timer_queue_iterate_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, bool descend) {
+    chDbgCheckClassI();
+
+    if (!task) {
+        return worker_thread_peek_timer_task_I(worker_thread);
+    }
+
+    switch (worker_thread->timer_queue) {
+        case WORKER_THREAD_TIMER_QUEUE_LIST:
+            return descend ? task->next : NULL;
+        case WORKER_THREAD_TIMER_QUEUE_HEAP:
+            // Depth-first walk, climbing back up through the parent links
+            if (descend && task->heap_child) {
+                return task->heap_child;
+            }
+            while (task && !task->next) {
+                task = worker_thread_timer_heap_get_parent(task);
+            }
+            return task ? task->next : NULL;
+    }
+    return NULL;
+}
+
+// - Returns the ticks until the worker thread has to wake up to run timer tasks: the end of the earliest slack window among the
+//   timer tasks that are due before it.
+static systime_t worker_thread_get_ticks_to_timer_wakeup_I(struct worker_thread_s* worker_thread, systime_t tnow_ticks) {
+    chDbgCheckClassI();
+
+    systime_t ticks_to_wakeup = TIME_INFINITE;
+    struct worker_thread_timer_task_s* task = NULL;
+    bool descend = true;
+    while ((task = worker_thread_timer_queue_iterate_I(worker_thread, task, descend)) != NULL) {
+        systime_t ticks_to_task = worker_thread_get_ticks_to_timer_task_I(task, tnow_ticks);
+        descend = ticks_to_task <= ticks_to_wakeup;
+        if (descend) {
+            systime_t ticks_to_window_end = ticks_to_task + MIN(task->timer_slack_ticks, TIME_INFINITE-1-ticks_to_task);
+            ticks_to_wakeup = MIN(ticks_to_wakeup, ticks_to_window_end);
+        }
+    }
+    return ticks_to_wakeup;
+}
+
+// - Counts the timer tasks due at tnow_ticks that would have run later than earliest_run_time without slack.
+static uint32_t worker_thread_count_coalesced_timer_tasks_I(struct worker_thread_s* worker_thread, systime_t tnow_ticks, systime_t earliest_run_time) {
+    chDbgCheckClassI();
+
+    uint32_t count = 0;
+    struct worker_thread_timer_task_s* task = NULL;
+    bool descend = true;
+    while ((task = worker_thread_timer_queue_iterate_I(worker_thread, task, descend)) != NULL) {
+        descend = worker_thread_get_ticks_to_timer_task_I(task, tnow_ticks) == TIME_IMMEDIATE;
+        if (descend && task->timer_begin_systime + task->timer_expiration_ticks != earliest_run_time) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static struct worker_thread_timer_task_s* worker_thread_timer_heap_get_parent(struct worker_thread_timer_task_s* task) {
+    while (task->heap_prev && task->heap_prev->heap_child != task) {
+        task = task->heap_prev;
+    }
+    return task->heap_prev;
+}
+
+// Returns true if task a runs no later than task b
+static bool worker_thread_timer_task_runs_before(struct worker_thread_timer_task_s* a, struct worker_thread_timer_task_s* b) {
+    systime_t a_run_time = a->timer_begin_systime + a->timer_expiration_ticks;
+    return a_run_time - b->timer_begin_systime < b->timer_expiration_ticks;
+}
+
+// Links two detached heaps, returns the new root
+static struct worker_thread_timer_task_s* worker_thread_timer_heap_meld(struct worker_thread_timer_task_s* a, struct worker_thread_timer_task_s* b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+
+    if (worker_thread_timer_task_runs_before(b, a)) {
+        struct worker_thread_timer_task_s* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    // b becomes the leftmost child of a
+    b->heap_prev = a;
+    b->next = a->heap_child;
+    if (a->heap_child) {
+        a->heap_child->heap_prev = b;
+    }
+    a->heap_child = b;
+    a->heap_prev = NULL;
+    a->next = NULL;
+    return a;
+}
+
+// Two-pass pairing of a sibling list, returns the new root
+static struct worker_thread_timer_task_s* worker_thread_timer_heap_merge_pairs(struct worker_thread_timer_task_s* first) {
+    // Meld siblings pairwise from left to right, collecting the results in reverse order
+    struct worker_thread_timer_task_s* reversed = NULL;
+    while (first) {
+        struct worker_thread_timer_task_s* a = first;
+        struct worker_thread_timer_task_s* b = a->next;
+        first = b ? b->next : NULL;
+
+        struct worker_thread_timer_task_s* melded = worker_thread_timer_heap_meld(a, b);
+        melded->next = reversed;
+        reversed = melded;
+    }
+
+    // Meld the results from right to left
+    struct worker_thread_timer_task_s* root = NULL;
+    while (reversed) {
+        struct worker_thread_timer_task_s* task = reversed;
+        reversed = task->next;
+        task->next = NULL;
+        root = worker_thread_timer_heap_meld(root, task);
+    }
+
+    if (root) {
+        root->heap_prev = NULL;
+    }
+    return root;
+}
+
+static void worker_thread_timer_heap_remove(struct worker_thread_timer_task_s** root, struct worker_thread_timer_task_s* task) {
+    if (task == *root) {
+        *root = worker_thread_timer_heap_merge_pairs(task->heap_child);
+    } else {
+        // Unlink the subtree rooted at task from its parent's child list, then meld its children back in
+        if (task->heap_prev->heap_child == task) {
+            task->heap_prev->heap_child = task->next;
+        } else {
+            task->heap_prev->next = task->next;
+        }
+        if (task->next) {
+            task->next->heap_prev = task->heap_prev;
+        }
+        *root = worker_thread_timer_heap_meld(*root, worker_thread_timer_heap_merge_pairs(task->heap_child));
+    }
+
+    task->heap_child = NULL;
+    task->heap_prev = NULL;
+    task->next = NULL;
+}
+
+static void worker_thread_insert_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
+    chDbgCheckClassI();
+    chDbgCheck(!worker_thread_timer_task_is_registered_I(worker_thread, task));
+
+    if (task->timer_expiration_ticks == TIME_INFINITE) {
+        return;
+    }
+
+    switch (worker_thread->timer_queue) {
+        case WORKER_THREAD_TIMER_QUEUE_LIST: {
+            systime_t task_run_time = task->timer_begin_systime + task->timer_expiration_ticks;
+            struct worker_thread_timer_task_s** insert_ptr = &worker_thread->timer_task_list_head;
+            while (*insert_ptr && task_run_time - (*insert_ptr)->timer_begin_systime >= (*insert_ptr)->timer_expiration_ticks) {
+                insert_ptr = &(*insert_ptr)->next;
+            }
+            task->next = *insert_ptr;
+            *insert_ptr = task;
+            break;
+        }
+        case WORKER_THREAD_TIMER_QUEUE_HEAP:
+            task->heap_child = NULL;
+            task->heap_prev = NULL;
+            task->next = NULL;
+            worker_thread->timer_task_heap_root = worker_thread_timer_heap_meld(worker_thread->timer_task_heap_root, task);
+            break;
+    }
+
+    task->queued = true;
+}
+
+static struct worker_thread_timer_task_s* worker_thread_peek_timer_task_I(struct worker_thread_s* worker_thread) {
+    chDbgCheckClassI();
+
+    switch (worker_thread->timer_queue) {
+        case WORKER_THREAD_TIMER_QUEUE_LIST:
+            return worker_thread->timer_task_list_head;
+        case WORKER_THREAD_TIMER_QUEUE_HEAP:
+            return worker_thread->timer_task_heap_root;
+    }
+    return NULL;
+}
+
+static void worker_thread_pop_timer_task_I(struct worker_thread_s* worker_thread) {
+    chDbgCheckClassI();
+
+    struct worker_thread_timer_task_s* task = worker_thread_peek_timer_task_I(worker_thread);
+    if (!task) {
+        return;
+    }
+
+    switch (worker_thread->timer_queue) {
+        case WORKER_THREAD_TIMER_QUEUE_LIST:
+            worker_thread->timer_task_list_head = task->next;
+            break;
+        case WORKER_THREAD_TIMER_QUEUE_HEAP:
+            worker_thread_timer_heap_remove(&worker_thread->timer_task_heap_root, task);
+            break;
+    }
+
+    task->queued = false;
+}
+
+static systime_t worker_thread_get_ticks_to_timer_task_I(struct worker_thread_timer_task_s* task, systime_t tnow_ticks) {
+    chDbgCheckClassI();
+
+    if (task && task->timer_expiration_ticks != TIME_INFINITE) {
+        systime_t elapsed = tnow_ticks - task->timer_begin_systime;
+        if (elapsed >= task->timer_expiration_ticks) {
+            return TIME_IMMEDIATE;
+        } else {
+            return task->timer_expiration_ticks - elapsed;
+        }
+    } else {
+        return TIME_INFINITE;
+    }
+}
+
+#if WORKER_THREAD_TASK_STATS_ENABLED
+static void worker_thread_timer_task_stats_register_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_timer_task_s** insert_ptr = &worker_thread->timer_task_stats_list_head;
+    while (*insert_ptr) {
+        if (*insert_ptr == task) {
+            // Already registered, keep accumulating
+            return;
+        }
+        insert_ptr = &(*insert_ptr)->next_in_stats_list;
+    }
+
+    memset(&task->stats, 0, sizeof(task->stats));
+    task->next_in_stats_list = NULL;
+    *insert_ptr = task;
+}
+
+static void worker_thread_timer_task_stats_unregister_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_timer_task_s** remove_ptr = &worker_thread->timer_task_stats_list_head;
+    while (*remove_ptr && *remove_ptr != task) {
+        remove_ptr = &(*remove_ptr)->next_in_stats_list;
+    }
+
+    if (*remove_ptr) {
+        *remove_ptr = task->next_in_stats_list;
+    }
+}
+
+static size_t worker_thread_task_stats_get_bin(uint32_t value) {
+    if (value == 0) {
+        return 0;
+    }
+    return MIN(32-__builtin_clz(value), WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS-1);
+}
+
+static void worker_thread_task_stats_record(struct worker_thread_task_stats_s* stats, uint32_t cycles, systime_t lateness) {
+    chSysLock();
+    stats->call_count++;
+    stats->total_cycles += cycles;
+    stats->max_cycles = MAX(stats->max_cycles, cycles);
+    stats->max_lateness = MAX(stats->max_lateness, lateness);
+    stats->runtime_histogram[worker_thread_task_stats_get_bin(cycles >> WORKER_THREAD_TASK_STATS_RUNTIME_SHIFT)]++;
+    stats->lateness_histogram[worker_thread_task_stats_get_bin(lateness)]++;
+    chSysUnlock();
+}
+
+bool worker_thread_iterate_timer_tasks(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s** task_ptr) {
+    if (!worker_thread || !task_ptr) {
+        return false;
+    }
+
+    chSysLock();
+    if (!(*task_ptr)) {
+        *task_ptr = worker_thread->timer_task_stats_list_head;
+    } else {
+        *task_ptr = (*task_ptr)->next_in_stats_list;
+    }
+    chSysUnlock();
+
+    return *task_ptr != NULL;
+}
+
+void worker_thread_timer_task_get_stats(struct worker_thread_timer_task_s* task, struct worker_thread_task_stats_s* ret, bool reset) {
+    if (!task || !ret) {
+        return;
+    }
+
+    chSysLock();
+    *ret = task->stats;
+    if (reset) {
+        memset(&task->stats, 0, sizeof(task->stats));
+    }
+    chSysUnlock();
+}
+
+#ifdef MODULE_PUBSUB_ENABLED
+bool worker_thread_iterate_listener_tasks(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s** task_ptr) {
+    if (!worker_thread || !task_ptr) {
+        return false;
+    }
+
+    chSysLock();
+    if (!(*task_ptr)) {
+        *task_ptr = worker_thread->listener_task_list_head;
+    } else {
+        *task_ptr = (*task_ptr)->next;
+    }
+    chSysUnlock();
+
+    return *task_ptr != NULL;
+}
+
+void worker_thread_listener_task_get_stats(struct worker_thread_listener_task_s* task, struct worker_thread_task_stats_s* ret, bool reset) {
+    if (!task || !ret) {
+        return;
+    }
+
+    chSysLock();
+    *ret = task->stats;
+    if (reset) {
+        memset(&task->stats, 0, sizeof(task->stats));
+    }
+    chSysUnlock();
+}
+#endif
+#endif
+
+#ifdef MODULE_PUBSUB_ENABLED
+static bool worker_thread_publisher_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* check_task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_publisher_task_s* task = worker_thread->publisher_task_list_head;
+    while (task) {
+        if (task == check_task) {
+            return true;
+        }
+        task = task->next;
+    }
+    return false;
+}
+
+static bool worker_thread_listener_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_listener_task_s* task = worker_thread->listener_task_list_head;
+    while (task) {
+        if (task == check_task) {
+            return true;
+        }
+        task = task->next;
+    }
+    return false;
+}
+
+static bool worker_thread_listener_task_is_registered(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* check_task) {
+    chSysLock();
+    bool ret = worker_thread_listener_task_is_registered_I(worker_thread, check_task);
+    chSysUnlock();
+    return ret;
+}
+
+static bool worker_thread_channel_task_is_registered_I(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* check_task) {
+    chDbgCheckClassI();
+
+    struct worker_thread_channel_task_s* task = worker_thread->channel_task_list_head;
+    while (task) {
+        if (task == check_task) {
+            return true;
+        }
+        task = task->next;
+    }
+    return false;
+}
+
+#endif
+
+#if WORKER_THREAD_WATCHDOG_ENABLED
+static void worker_thread_runtime_begin(struct worker_thread_s* worker_thread, const void* task, const void* task_func, systime_t budget_ticks) {
+    chSysLock();
+    worker_thread->current_task = task;
+    worker_thread->current_task_func = task_func;
+    worker_thread->current_task_begin_systime = chVTGetSystemTimeX();
+    worker_thread->current_task_budget_ticks = budget_ticks;
+    worker_thread->current_task_overrun_reported = false;
+    worker_thread->current_task_running = true;
+    chSysUnlock();
+}
+
+static void worker_thread_runtime_end(struct worker_thread_s* worker_thread) {
+    chSysLock();
+    worker_thread->current_task_running = false;
+    chSysUnlock();
+}
+
+static void worker_thread_runtime_begin_ready_link(struct worker_thread_s* worker_thread, struct worker_thread_ready_link_s* link) {
+    const void* task = NULL;
+    const void* task_func = NULL;
+
+    switch (link->type) {
+        case WORKER_THREAD_READY_COROUTINE_TASK: {
+            struct worker_thread_coroutine_task_s* coroutine_task = (struct worker_thread_coroutine_task_s*)((uint8_t*)link - offsetof(struct worker_thread_coroutine_task_s, ready_link));
+            task = coroutine_task;
+            task_func = (const void*)coroutine_task->func;
+            break;
+        }
+#ifdef MODULE_PUBSUB_ENABLED
+        case WORKER_THREAD_READY_LISTENER_TASK: {
+            struct worker_thread_listener_task_s* listener_task = (struct worker_thread_listener_task_s*)((uint8_t*)link - offsetof(struct worker_thread_listener_task_s, ready_link));
+            task = listener_task;
+            task_func = listener_task->listener.batch_handler_cb ? (const void*)listener_task->listener.batch_handler_cb : (const void*)listener_task->listener.handler_cb;
+            break;
+        }
+        case WORKER_THREAD_READY_PUBLISHER_TASK:
+            task = (uint8_t*)link - offsetof(struct worker_thread_publisher_task_s, ready_link);
+            break;
+        case WORKER_THREAD_READY_CHANNEL_TASK: {
+            struct worker_thread_channel_task_s* channel_task = (struct worker_thread_channel_task_s*)((uint8_t*)link - offsetof(struct worker_thread_channel_task_s, ready_link));
+            task = channel_task;
+            task_func = (const void*)channel_task->handler_cb;
+            break;
+        }
+#else
+        default:
+            break;
+#endif
+    }
+
+    worker_thread_runtime_begin(worker_thread, task, task_func, link->runtime_budget_ticks);
+}
+
+void worker_thread_timer_task_set_runtime_budget(struct worker_thread_timer_task_s* task, systime_t budget_ticks) {
+    task->runtime_budget_ticks = budget_ticks;
+}
+
+void worker_thread_coroutine_task_set_runtime_budget(struct worker_thread_coroutine_task_s* task, systime_t budget_ticks) {
+    task->ready_link.runtime_budget_ticks = budget_ticks;
+}
+
+#ifdef MODULE_PUBSUB_ENABLED
+void worker_thread_listener_task_set_runtime_budget(struct worker_thread_listener_task_s* task, systime_t budget_ticks) {
+    task->ready_link.runtime_budget_ticks = budget_ticks;
+}
+
+void worker_thread_channel_task_set_runtime_budget(struct worker_thread_channel_task_s* task, systime_t budget_ticks) {
+    task->ready_link.runtime_budget_ticks = budget_ticks;
+}
+#endif
+
+enum worker_thread_runtime_budget_state_t worker_thread_check_runtime_budget_I(struct worker_thread_s* worker_thread, struct worker_thread_runtime_overrun_s* overrun_ret) {
+    chDbgCheckClassI();
+
+    if (!worker_thread->current_task_running || worker_thread->current_task_budget_ticks == TIME_INFINITE) {
+        return WORKER_THREAD_RUNTIME_WITHIN_BUDGET;
+    }
+
+    systime_t elapsed_ticks = chVTTimeElapsedSinceX(worker_thread->current_task_begin_systime);
+    if (elapsed_ticks <= worker_thread->current_task_budget_ticks) {
+        return WORKER_THREAD_RUNTIME_WITHIN_BUDGET;
+    }
+
+    if (worker_thread->current_task_overrun_reported) {
+        return WORKER_THREAD_RUNTIME_OVERRUN;
+    }
+
+    worker_thread->current_task_overrun_reported = true;
+    worker_thread->runtime_overruns++;
+
+    if (overrun_ret) {
+        overrun_ret->worker_thread = worker_thread;
+        overrun_ret->task = worker_thread->current_task;
+        overrun_ret->task_func = worker_thread->current_task_func;
+        overrun_ret->budget_ticks = worker_thread->current_task_budget_ticks;
+        overrun_ret->elapsed_ticks = elapsed_ticks;
+    }
+
+    return WORKER_THREAD_RUNTIME_OVERRUN_NEW;
+}
+
+uint32_t worker_thread_get_runtime_overruns(struct worker_thread_s* worker_thread) {
+    return worker_thread->runtime_overruns;
+}
+
+bool worker_thread_check_progress_I(struct worker_thread_s* worker_thread) {
+    chDbgCheckClassI();
+
+    if (!worker_thread->thread) {
+        return true;
+    }
+
+    // suspend_trp only points at the thread while it sleeps waiting for work. It is cleared as soon as the thread is woken,
+    // so a thread that is woken but never scheduled does not count as idle.
+    bool progressed = worker_thread->loop_count != worker_thread->loop_count_checked || worker_thread->suspend_trp != NULL;
+    worker_thread->loop_count_checked = worker_thread->loop_count;
+    return progressed;
 }
 #endif
@@ -7,6 +7,46 @@
 #include <modules/pubsub/pubsub.h>
 #endif
 
+#ifndef WORKER_THREAD_TASK_STATS_ENABLED
+#define WORKER_THREAD_TASK_STATS_ENABLED FALSE
+#endif
+
+#ifndef WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS
+#define WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS 16
+#endif
+
+// Runtime histogram bins are log2 of the runtime in units of (1 << WORKER_THREAD_TASK_STATS_RUNTIME_SHIFT) cycles
+#ifndef WORKER_THREAD_TASK_STATS_RUNTIME_SHIFT
+#define WORKER_THREAD_TASK_STATS_RUNTIME_SHIFT 6
+#endif
+
+#ifndef WORKER_THREAD_WATCHDOG_ENABLED
+#define WORKER_THREAD_WATCHDOG_ENABLED FALSE
+#endif
+
+// Runtime budget of tasks that have not been given one with a worker_thread_*_set_runtime_budget function
+#ifndef WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET
+#define WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET MS2ST(20)
+#endif
+
+// Maximum number of messages a listener or publisher task handles each time the worker thread dispatches it
+#ifndef WORKER_THREAD_DISPATCH_BUDGET
+#define WORKER_THREAD_DISPATCH_BUDGET 8
+#endif
+
+#define WORKER_THREAD_READY_BITS 32
+
+// Number of dispatches in a row that may pass over a ready task in favour of a higher-priority one, before every ready
+// task is served once regardless of priority
+#ifndef WORKER_THREAD_PRIORITY_STARVATION_LIMIT
+#define WORKER_THREAD_PRIORITY_STARVATION_LIMIT 16
+#endif
+
+// Number of deferred work items that can be pending on each worker thread
+#ifndef WORKER_THREAD_DEFERRED_WORK_QUEUE_DEPTH
+#define WORKER_THREAD_DEFERRED_WORK_QUEUE_DEPTH 8
+#endif
+
 #define __WORKER_THREAD_CONCAT(a,b) a ## b
 #define _WORKER_THREAD_CONCAT(a,b) __WORKER_THREAD_CONCAT(a,b)
 
@@ -30,11 +70,15 @@ int main(void) { \
 #define WORKER_THREAD_DECLARE_EXTERN(NAME) \
 extern struct worker_thread_s NAME;
 
+#ifndef WORKER_THREAD_PERIODIC_TIMER_TASK_OVERRUN_POLICY
+#define WORKER_THREAD_PERIODIC_TIMER_TASK_OVERRUN_POLICY WORKER_THREAD_TIMER_OVERRUN_SKIP
+#endif
+
 #define WORKER_THREAD_PERIODIC_TIMER_TASK_AUTOSTART(TASK_NAME, WORKER_THREAD, PERIOD) \
 static struct worker_thread_timer_task_s TASK_NAME; \
 static void _WORKER_THREAD_CONCAT(TASK_NAME,_handler_func)(struct worker_thread_timer_task_s* task); \
 RUN_ON(INIT_END) { \
-    worker_thread_add_timer_task(WORKER_THREAD, &TASK_NAME, _WORKER_THREAD_CONCAT(TASK_NAME,_handler_func), NULL, PERIOD, true); \
+    worker_thread_add_periodic_timer_task(WORKER_THREAD, &TASK_NAME, _WORKER_THREAD_CONCAT(TASK_NAME,_handler_func), NULL, PERIOD, WORKER_THREAD_PERIODIC_TIMER_TASK_OVERRUN_POLICY); \
 } \
 static void _WORKER_THREAD_CONCAT(TASK_NAME,_handler_func)(struct worker_thread_timer_task_s* task)
 
@@ -44,18 +88,105 @@ struct worker_thread_s;
 
 typedef void (*timer_task_handler_func_ptr)(struct worker_thread_timer_task_s* task);
 
+#if WORKER_THREAD_TASK_STATS_ENABLED
+struct worker_thread_task_stats_s {
+    uint32_t call_count;
+    uint64_t total_cycles;
+    uint32_t max_cycles;
+    systime_t max_lateness;
+    uint32_t runtime_histogram[WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS];
+    uint32_t lateness_histogram[WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS];
+};
+#endif
+
+// - WORKER_THREAD_TIMER_QUEUE_LIST keeps timer tasks in a sorted linked list. Inserting and cancelling are O(n), popping the
+//   earliest task is O(1). This is cheapest for worker threads with only a handful of timer tasks.
+// - WORKER_THREAD_TIMER_QUEUE_HEAP keeps timer tasks in an intrusive pairing heap. Inserting is O(1), popping the earliest task
+//   and cancelling are amortized O(log n). Tasks with equal expiration times are not guaranteed to run in insertion order.
+enum worker_thread_timer_queue_t {
+    WORKER_THREAD_TIMER_QUEUE_LIST,
+    WORKER_THREAD_TIMER_QUEUE_HEAP,
+};
+
+// - Periodic timer tasks run on a fixed grid of release times, so their phase does not slip when the worker thread is busy.
+//   When a run ends after the next release time has already passed, the overrun policy decides what happens to the releases
+//   that were missed:
+// - WORKER_THREAD_TIMER_OVERRUN_SKIP drops them and waits for the next release time that has not passed yet.
+// - WORKER_THREAD_TIMER_OVERRUN_CATCH_UP runs the task once for each of them, back-to-back.
+// - WORKER_THREAD_TIMER_OVERRUN_COALESCE runs the task once right away in place of all of them.
+enum worker_thread_timer_overrun_policy_t {
+    WORKER_THREAD_TIMER_OVERRUN_SKIP,
+    WORKER_THREAD_TIMER_OVERRUN_CATCH_UP,
+    WORKER_THREAD_TIMER_OVERRUN_COALESCE,
+};
+
 struct worker_thread_timer_task_s {
     timer_task_handler_func_ptr task_func;
     void* ctx;
     systime_t timer_expiration_ticks;
     systime_t timer_begin_systime;
     bool auto_repeat;
-    struct worker_thread_timer_task_s* next;
+    bool periodic;
+    enum worker_thread_timer_overrun_policy_t overrun_policy;
+    uint32_t missed_deadlines;
+    systime_t max_lateness;
+    systime_t timer_slack_ticks;
+    uint8_t priority;
+    bool queued;
+    struct worker_thread_timer_task_s* heap_child;
+    struct worker_thread_timer_task_s* heap_prev; // Parent if this is its leftmost child, left sibling otherwise
+    struct worker_thread_timer_task_s* next; // Next in list, or right sibling in heap
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    struct worker_thread_task_stats_s stats;
+    struct worker_thread_timer_task_s* next_in_stats_list;
+#endif
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    systime_t runtime_budget_ticks;
+#endif
+};
+
+enum worker_thread_ready_task_type_t {
+    WORKER_THREAD_READY_COROUTINE_TASK,
+    WORKER_THREAD_READY_LISTENER_TASK,
+    WORKER_THREAD_READY_PUBLISHER_TASK,
+    WORKER_THREAD_READY_CHANNEL_TASK,
+};
+
+// - Each coroutine, listener, publisher and channel task is given one of the worker thread's ready bits, which is set whenever
+//   the task has work to do. Tasks only share a bit once a worker thread has more than WORKER_THREAD_READY_BITS of them.
+struct worker_thread_ready_link_s {
+    enum worker_thread_ready_task_type_t type;
+    uint8_t bit;
+    uint8_t priority;
+    struct worker_thread_ready_link_s* next_in_bit;
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    systime_t runtime_budget_ticks;
+#endif
+};
+
+struct worker_thread_coroutine_task_s;
+
+typedef void (*worker_thread_coroutine_func_ptr)(struct worker_thread_coroutine_task_s* task);
+
+struct worker_thread_coroutine_task_s {
+    worker_thread_coroutine_func_ptr func;
+    void* ctx;
+    uint16_t resume_point;
+    volatile bool signaled;
+    bool sleeping;
+    struct worker_thread_timer_task_s sleep_timer_task;
+    struct worker_thread_ready_link_s ready_link;
+    struct worker_thread_s* worker_thread;
 };
 
 #ifdef MODULE_PUBSUB_ENABLED
 struct worker_thread_listener_task_s {
     struct pubsub_listener_s listener;
+    struct worker_thread_s* worker_thread;
+    struct worker_thread_ready_link_s ready_link;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    struct worker_thread_task_stats_s stats;
+#endif
     struct worker_thread_listener_task_s* next;
 };
 
@@ -69,9 +200,54 @@ struct worker_thread_publisher_task_s {
     size_t msg_max_size;
     memory_pool_t pool;
     mailbox_t mailbox;
+    struct worker_thread_ready_link_s ready_link;
     struct worker_thread_s* worker_thread;
     struct worker_thread_publisher_task_s* next;
 };
+
+struct worker_thread_channel_msg_s {
+    struct pubsub_topic_s* topic;
+    size_t size;
+    uint8_t data[] __attribute__((aligned));
+};
+
+struct worker_thread_channel_task_s {
+    size_t msg_max_size;
+    size_t slot_size;
+    size_t num_slots;
+    uint8_t* slots;
+    volatile size_t head; // Written only by the producer
+    volatile size_t tail; // Written only by the worker thread
+    uint32_t overruns;
+    pubsub_message_handler_func_ptr handler_cb;
+    void* handler_cb_ctx;
+    struct worker_thread_ready_link_s ready_link;
+    struct worker_thread_s* worker_thread;
+    struct worker_thread_channel_task_s* next;
+};
+#endif
+
+typedef void (*worker_thread_deferred_work_func_ptr)(void* arg);
+
+struct worker_thread_deferred_work_s {
+    worker_thread_deferred_work_func_ptr func;
+    void* arg;
+};
+
+#if WORKER_THREAD_WATCHDOG_ENABLED
+enum worker_thread_runtime_budget_state_t {
+    WORKER_THREAD_RUNTIME_WITHIN_BUDGET,
+    WORKER_THREAD_RUNTIME_OVERRUN_NEW,
+    WORKER_THREAD_RUNTIME_OVERRUN,
+};
+
+struct worker_thread_runtime_overrun_s {
+    struct worker_thread_s* worker_thread;
+    const void* task; // The timer, listener, publisher, channel or coroutine task struct, or NULL for deferred work
+    const void* task_func; // The task's handler function, if it has one
+    systime_t budget_ticks;
+    systime_t elapsed_ticks;
+};
 #endif
 
 struct worker_thread_s {
@@ -79,28 +255,224 @@ struct worker_thread_s {
     tprio_t priority;
     thread_t* thread;
     thread_t* suspend_trp;
+    enum worker_thread_timer_queue_t timer_queue;
     struct worker_thread_timer_task_s* timer_task_list_head;
+    struct worker_thread_timer_task_s* timer_task_heap_root;
+    uint32_t timer_wakeups_saved;
+#if WORKER_THREAD_TASK_STATS_ENABLED
+    struct worker_thread_timer_task_s* timer_task_stats_list_head;
+#endif
 #ifdef MODULE_PUBSUB_ENABLED
     struct worker_thread_listener_task_s* listener_task_list_head;
     struct worker_thread_publisher_task_s* publisher_task_list_head;
+    struct worker_thread_channel_task_s* channel_task_list_head;
+#endif
+    uint32_t ready_mask;
+    uint8_t next_ready_bit;
+    struct worker_thread_ready_link_s* ready_link_heads[WORKER_THREAD_READY_BITS];
+    uint8_t ready_bit_priority[WORKER_THREAD_READY_BITS]; // Highest priority of the tasks sharing each ready bit
+    uint8_t ready_scan_start;
+    uint32_t priority_dispatch_streak;
+    // One slot is always left empty to tell a full ring from an empty one
+    struct worker_thread_deferred_work_s deferred_work[WORKER_THREAD_DEFERRED_WORK_QUEUE_DEPTH+1];
+    volatile size_t deferred_work_head; // Written only by producers, with the system locked
+    volatile size_t deferred_work_tail; // Written only by the worker thread
+    uint32_t deferred_work_overruns;
+#if WORKER_THREAD_WATCHDOG_ENABLED
+    volatile bool current_task_running;
+    const void* current_task;
+    const void* current_task_func;
+    systime_t current_task_begin_systime;
+    systime_t current_task_budget_ticks;
+    bool current_task_overrun_reported;
+    uint32_t runtime_overruns;
+    volatile uint32_t loop_count; // Passes through the dispatch loop
+    uint32_t loop_count_checked; // loop_count as of the last worker_thread_check_progress_I
 #endif
+    struct worker_thread_s* next;
 };
 
 void worker_thread_init(struct worker_thread_s* worker_thread, const char* name, tprio_t priority);
 void worker_thread_start(struct worker_thread_s* worker_thread, size_t stack_size);
 void worker_thread_takeover(struct worker_thread_s* worker_thread);
+
+// - Selects the timer queue backend of a worker thread. Timer tasks that are already registered are moved to the new queue.
+void worker_thread_set_timer_queue_I(struct worker_thread_s* worker_thread, enum worker_thread_timer_queue_t timer_queue);
+void worker_thread_set_timer_queue(struct worker_thread_s* worker_thread, enum worker_thread_timer_queue_t timer_queue);
+
 void worker_thread_add_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t timer_expiration_ticks, bool auto_repeat);
 void worker_thread_add_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t timer_expiration_ticks, bool auto_repeat);
+
+// - Adds a periodic timer task that first runs one period from now. See enum worker_thread_timer_overrun_policy_t.
+// - Rescheduling a periodic timer task restarts its grid of release times from the time it is rescheduled.
+void worker_thread_add_periodic_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t period_ticks, enum worker_thread_timer_overrun_policy_t overrun_policy);
+void worker_thread_add_periodic_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, timer_task_handler_func_ptr task_func, void* ctx, systime_t period_ticks, enum worker_thread_timer_overrun_policy_t overrun_policy);
+
+// - A release misses its deadline if the task has not started running for it by the next release time, or if it is dropped
+//   or coalesced by the overrun policy.
+// - Lateness is the time from a release to the task starting to run for it.
+uint32_t worker_thread_timer_task_get_missed_deadlines(struct worker_thread_timer_task_s* task);
+systime_t worker_thread_timer_task_get_max_lateness(struct worker_thread_timer_task_s* task);
+
+// - Tasks with a higher priority are run first when several are ready. All tasks have priority 0 until it is set. Priorities
+//   must be set after the task is added.
+// - Due timer tasks still run in order of due time among themselves. A timer task's priority decides whether it runs
+//   before or after the ready listener, publisher, channel and coroutine tasks.
+// - A task is never preempted by a higher-priority one, and WORKER_THREAD_PRIORITY_STARVATION_LIMIT bounds how long
+//   lower-priority tasks can be held up by a stream of higher-priority work.
+void worker_thread_timer_task_set_priority(struct worker_thread_timer_task_s* task, uint8_t priority);
+
+// - Lets the task run up to slack_ticks after it is due, so that the worker thread can run it on the same wakeup as other
+//   timer tasks instead of waking up for it separately. The worker thread sleeps until the end of the earliest slack window of
+//   the timer tasks due soonest, and then runs every timer task that is due. Defaults to 0.
+void worker_thread_timer_task_set_slack(struct worker_thread_timer_task_s* task, systime_t slack_ticks);
+
+// - Returns the number of timer tasks that ran on a wakeup scheduled for an earlier timer task's deadline and delayed by
+//   slack, each of which would otherwise have needed a wakeup of its own.
+uint32_t worker_thread_get_timer_wakeups_saved(struct worker_thread_s* worker_thread);
+
 void worker_thread_timer_task_reschedule_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, systime_t timer_expiration_ticks);
 void worker_thread_timer_task_reschedule(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task, systime_t timer_expiration_ticks);
 void worker_thread_remove_timer_task_I(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
 void worker_thread_remove_timer_task(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s* task);
 void* worker_thread_task_get_user_context(struct worker_thread_timer_task_s* task);
+
+// - Coroutine tasks are stackless coroutines, protothread style, that run on the worker thread's stack. A coroutine function
+//   is written as a sequence of steps separated by awaits. At each await, the function returns to the worker thread and is
+//   re-entered at that await when the coroutine is woken, so many coroutines can wait at once without a stack each.
+// - Local variables do not survive an await. Keep state in the memory pointed to by task->ctx.
+// - The body must be wrapped in WORKER_THREAD_COROUTINE_BEGIN and WORKER_THREAD_COROUTINE_END, and must not contain a switch
+//   statement with an await in it or more than one await on a line.
+// - Conditions passed to WORKER_THREAD_COROUTINE_AWAIT_UNTIL are re-evaluated each time the coroutine is woken. A coroutine
+//   is woken by its sleep timer, by a signal, by a message on a listener it awaits, and by tasks sharing its ready bit.
+// - Completion of a DMA transfer or any other interrupt-driven operation is awaited with WORKER_THREAD_COROUTINE_AWAIT_SIGNAL,
+//   and signalled from the completion callback with worker_thread_coroutine_task_signal_I, e.g. from a SPIConfig end_cb.
+#define WORKER_THREAD_COROUTINE_FINISHED 0xFFFF
+
+#define WORKER_THREAD_COROUTINE_BEGIN(TASK) switch ((TASK)->resume_point) { case 0:
+
+#define WORKER_THREAD_COROUTINE_END(TASK) } (TASK)->resume_point = WORKER_THREAD_COROUTINE_FINISHED; return
+
+// The resume label sits in a dead block so that reaching the await does not fall through into a case label
+#define WORKER_THREAD_COROUTINE_AWAIT_UNTIL(TASK, COND) do { \
+    (TASK)->resume_point = __LINE__; \
+    if (0) { case __LINE__:; } \
+    if (!(COND)) { \
+        return; \
+    } \
+} while (0)
+
+#define WORKER_THREAD_COROUTINE_AWAIT_SLEEP(TASK, TICKS) do { \
+    worker_thread_coroutine_task_start_sleep(TASK, TICKS); \
+    WORKER_THREAD_COROUTINE_AWAIT_UNTIL(TASK, !worker_thread_coroutine_task_is_sleeping(TASK)); \
+} while (0)
+
+#define WORKER_THREAD_COROUTINE_AWAIT_SIGNAL(TASK) \
+    WORKER_THREAD_COROUTINE_AWAIT_UNTIL(TASK, worker_thread_coroutine_task_consume_signal(TASK))
+
+// - Waits until the listener has a message. Handle it with pubsub_listener_handle_one_timeout(listener, TIME_IMMEDIATE).
+#define WORKER_THREAD_COROUTINE_AWAIT_MESSAGE(TASK, LISTENER) \
+    WORKER_THREAD_COROUTINE_AWAIT_UNTIL(TASK, worker_thread_coroutine_task_listener_has_message(TASK, LISTENER))
+
+// - Lets the worker thread's other tasks run before continuing.
+#define WORKER_THREAD_COROUTINE_YIELD(TASK) do { \
+    worker_thread_coroutine_task_yield(TASK); \
+    (TASK)->resume_point = __LINE__; \
+    return; \
+    case __LINE__:; \
+} while (0)
+
+void worker_thread_add_coroutine_task(struct worker_thread_s* worker_thread, struct worker_thread_coroutine_task_s* task, worker_thread_coroutine_func_ptr func, void* ctx);
+void worker_thread_remove_coroutine_task(struct worker_thread_s* worker_thread, struct worker_thread_coroutine_task_s* task);
+void worker_thread_coroutine_task_signal_I(struct worker_thread_coroutine_task_s* task);
+void worker_thread_coroutine_task_signal(struct worker_thread_coroutine_task_s* task);
+bool worker_thread_coroutine_task_consume_signal(struct worker_thread_coroutine_task_s* task);
+void worker_thread_coroutine_task_start_sleep(struct worker_thread_coroutine_task_s* task, systime_t ticks);
+bool worker_thread_coroutine_task_is_sleeping(struct worker_thread_coroutine_task_s* task);
+void worker_thread_coroutine_task_yield(struct worker_thread_coroutine_task_s* task);
+#ifdef MODULE_PUBSUB_ENABLED
+bool worker_thread_coroutine_task_listener_has_message(struct worker_thread_coroutine_task_s* task, struct pubsub_listener_s* listener);
+#endif
+
+// - Iterates over all worker threads, in order of initialization. Pass a pointer to NULL to get the first worker thread.
+// - Returns false once there are no more worker threads.
+bool worker_thread_iterate_worker_threads(struct worker_thread_s** worker_thread_ptr);
+
+// - Queues func(arg) to be called from the worker thread. Deferred work is run before any other task each time the worker
+//   thread goes through its loop, so interrupt handlers can hand work off to thread context without a publisher task.
+// - Nothing is copied: arg must remain valid until func has been called.
+// - Returns false, and counts an overrun, if WORKER_THREAD_DEFERRED_WORK_QUEUE_DEPTH items are already pending.
+bool worker_thread_defer_I(struct worker_thread_s* worker_thread, worker_thread_deferred_work_func_ptr func, void* arg);
+bool worker_thread_defer(struct worker_thread_s* worker_thread, worker_thread_deferred_work_func_ptr func, void* arg);
+uint32_t worker_thread_get_deferred_work_overruns(struct worker_thread_s* worker_thread);
+
+#if WORKER_THREAD_WATCHDOG_ENABLED
+// - Runtime budgets are only tracked when WORKER_THREAD_WATCHDOG_ENABLED is TRUE. They are checked by sampling, see the
+//   worker_thread_watchdog module. Nothing interrupts a task that exceeds its budget.
+// - A budget of TIME_INFINITE disables the check for a task. Budgets must be set after the task is added.
+// - Deferred work and publisher tasks always have WORKER_THREAD_WATCHDOG_DEFAULT_RUNTIME_BUDGET.
+void worker_thread_timer_task_set_runtime_budget(struct worker_thread_timer_task_s* task, systime_t budget_ticks);
+void worker_thread_coroutine_task_set_runtime_budget(struct worker_thread_coroutine_task_s* task, systime_t budget_ticks);
+
+// - Checks the task the worker thread is currently running against its runtime budget. Returns
+//   WORKER_THREAD_RUNTIME_OVERRUN_NEW, and fills overrun_ret, the first time a run of a task is seen over budget, and
+//   WORKER_THREAD_RUNTIME_OVERRUN on later checks until the task returns.
+enum worker_thread_runtime_budget_state_t worker_thread_check_runtime_budget_I(struct worker_thread_s* worker_thread, struct worker_thread_runtime_overrun_s* overrun_ret);
+uint32_t worker_thread_get_runtime_overruns(struct worker_thread_s* worker_thread);
+
+// - Returns true if the worker thread has gone back to its dispatch loop since the last call, or is sleeping because it has
+//   nothing to do. Returns false for a worker thread that is stuck in a task, spinning, or ready but starved of CPU time,
+//   whether or not the task it is in has a runtime budget. Worker threads that have not started yet count as progressing.
+bool worker_thread_check_progress_I(struct worker_thread_s* worker_thread);
+#endif
+
+#if WORKER_THREAD_TASK_STATS_ENABLED
+// - Statistics are only collected when WORKER_THREAD_TASK_STATS_ENABLED is TRUE.
+// - Timer task statistics cover every timer task added to the worker thread and not removed since, whether it is currently
+//   queued or not. Listener task statistics only count calls that handled a message.
+// - Runtime is measured in realtime counter cycles. Lateness is measured in system ticks: for timer tasks, from the time the
+//   task was due, and for listener tasks, from the time the message handled first was published.
+// - Copies a consistent snapshot of the task's statistics into ret. If reset is true, the statistics are cleared after they
+//   are copied, so that successive calls return per-interval statistics.
+bool worker_thread_iterate_timer_tasks(struct worker_thread_s* worker_thread, struct worker_thread_timer_task_s** task_ptr);
+void worker_thread_timer_task_get_stats(struct worker_thread_timer_task_s* task, struct worker_thread_task_stats_s* ret, bool reset);
+#ifdef MODULE_PUBSUB_ENABLED
+bool worker_thread_iterate_listener_tasks(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s** task_ptr);
+void worker_thread_listener_task_get_stats(struct worker_thread_listener_task_s* task, struct worker_thread_task_stats_s* ret, bool reset);
+#endif
+#endif
 #ifdef MODULE_PUBSUB_ENABLED
 void worker_thread_add_listener_task(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* task, struct pubsub_topic_s* topic, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx);
+
+// - Adds a listener task that handles messages in batches with batch_handler_cb. See pubsub_listener_set_batch_handler_cb.
+// - time_budget limits how long a single batch may hold up the worker thread's other tasks.
+void worker_thread_add_batch_listener_task(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* task, struct pubsub_topic_s* topic, pubsub_batch_handler_func_ptr batch_handler_cb, void* handler_cb_ctx, size_t max_batch_size, systime_t time_budget);
+
 void worker_thread_remove_listener_task(struct worker_thread_s* worker_thread, struct worker_thread_listener_task_s* task);
+
+// - Sets the priority the listener task is run with when several tasks are ready, as worker_thread_timer_task_set_priority
+//   does for timer tasks.
+void worker_thread_listener_task_set_priority(struct worker_thread_listener_task_s* task, uint8_t priority);
 void worker_thread_add_publisher_task_I(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* task, size_t msg_max_size, size_t msg_queue_depth);
 void worker_thread_add_publisher_task(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* task, size_t msg_max_size, size_t msg_queue_depth);
 void worker_thread_remove_publisher_task(struct worker_thread_s* worker_thread, struct worker_thread_publisher_task_s* task);
 bool worker_thread_publisher_task_publish_I(struct worker_thread_publisher_task_s* task, struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
+
+// - Channel tasks are fixed-size single-producer/single-consumer rings for handing messages from an ISR to a worker thread.
+//   The producer writes a message straight into a ring slot without taking any lock or allocating, and the worker thread
+//   drains every pending slot each time it wakes.
+// - If handler_cb is not NULL, it is called on the worker thread with a pointer into the ring slot, so the message is read in
+//   place and never copied. Otherwise, each message is published on the topic it was written with.
+// - Only one context may publish on a channel task at a time. Interrupt handlers that share a channel must serialize their
+//   calls, e.g. by publishing from within chSysLockFromISR.
+void worker_thread_add_channel_task_I(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task, size_t msg_max_size, size_t msg_queue_depth, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx);
+void worker_thread_add_channel_task(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task, size_t msg_max_size, size_t msg_queue_depth, pubsub_message_handler_func_ptr handler_cb, void* handler_cb_ctx);
+void worker_thread_remove_channel_task(struct worker_thread_s* worker_thread, struct worker_thread_channel_task_s* task);
+bool worker_thread_channel_task_publish_I(struct worker_thread_channel_task_s* task, struct pubsub_topic_s* topic, size_t size, pubsub_message_writer_func_ptr writer_cb, void* ctx);
+uint32_t worker_thread_channel_task_get_overruns(struct worker_thread_channel_task_s* task);
+
+#if WORKER_THREAD_WATCHDOG_ENABLED
+void worker_thread_listener_task_set_runtime_budget(struct worker_thread_listener_task_s* task, systime_t budget_ticks);
+void worker_thread_channel_task_set_runtime_budget(struct worker_thread_channel_task_s* task, systime_t budget_ticks);
+#endif
 #endif
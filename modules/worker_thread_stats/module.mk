@@ -0,0 +1 @@
+UDEFS += -DWORKER_THREAD_TASK_STATS_ENABLED=TRUE
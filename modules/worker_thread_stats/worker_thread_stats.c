@@ -0,0 +1,110 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <common/ctor.h>
+#include <ch.h>
+#include <hal.h>
+#include <modules/worker_thread/worker_thread.h>
+#include <modules/uavcan_debug/uavcan_debug.h>
+#include <common/helpers.h>
+#include <stdio.h>
+
+#if !WORKER_THREAD_TASK_STATS_ENABLED
+#error worker_thread_stats requires WORKER_THREAD_TASK_STATS_ENABLED.
+#endif
+
+#ifndef WORKER_THREAD_STATS_WORKER_THREAD
+#error Please define WORKER_THREAD_STATS_WORKER_THREAD in framework_conf.h.
+#endif
+
+#ifndef WORKER_THREAD_STATS_PRINT_INTERVAL_S
+#define WORKER_THREAD_STATS_PRINT_INTERVAL_S 10
+#endif
+
+#define WT WORKER_THREAD_STATS_WORKER_THREAD
+WORKER_THREAD_DECLARE_EXTERN(WT)
+
+static struct worker_thread_timer_task_s stats_print_task;
+static void stats_print_task_func(struct worker_thread_timer_task_s* task);
+
+RUN_AFTER(WORKER_THREADS_INIT) {
+    worker_thread_add_timer_task(&WT, &stats_print_task, stats_print_task_func, NULL, S2ST(WORKER_THREAD_STATS_PRINT_INTERVAL_S), true);
+    worker_thread_timer_task_set_slack(&stats_print_task, S2ST(1));
+}
+
+static unsigned cycles_to_us(uint64_t cycles) {
+    return (unsigned)(cycles/(STM32_SYSCLK/1000000));
+}
+
+// Prints one count per log2 bin, starting at the first non-empty bin
+static void print_histogram(const char* worker_thread_name, const char* task_id, const char* label, const uint32_t* histogram) {
+    char buf[80];
+    uint32_t first_bin_min = format_log2_histogram(buf, sizeof(buf), histogram, WORKER_THREAD_TASK_STATS_HISTOGRAM_BINS);
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "wt", "%s %s %s>=%u:%s", worker_thread_name, task_id, label, (unsigned)first_bin_min, buf);
+}
+
+static void print_task_stats(const char* worker_thread_name, const char* task_id, const struct worker_thread_task_stats_s* stats) {
+    if (stats->call_count == 0) {
+        return;
+    }
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "wt", "%s %s: n %u tot %uus avg %uus max %uus late %u", worker_thread_name, task_id,
+        (unsigned)stats->call_count, cycles_to_us(stats->total_cycles), cycles_to_us(stats->total_cycles/stats->call_count),
+        cycles_to_us(stats->max_cycles), (unsigned)stats->max_lateness);
+
+    // Runtime bins are in units of 1<<WORKER_THREAD_TASK_STATS_RUNTIME_SHIFT cycles, lateness bins in system ticks
+    print_histogram(worker_thread_name, task_id, "run", stats->runtime_histogram);
+    print_histogram(worker_thread_name, task_id, "late", stats->lateness_histogram);
+}
+
+static void print_worker_thread_stats(struct worker_thread_s* worker_thread) {
+    char task_id[24];
+    struct worker_thread_task_stats_s stats;
+
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_INFO, "wt", "%s: wakeups saved %u", worker_thread->name, (unsigned)worker_thread_get_timer_wakeups_saved(worker_thread));
+
+    // Timer tasks have no name, so they are identified by their handler's address
+    struct worker_thread_timer_task_s* timer_task = NULL;
+    while (worker_thread_iterate_timer_tasks(worker_thread, &timer_task)) {
+        worker_thread_timer_task_get_stats(timer_task, &stats, true);
+        snprintf(task_id, sizeof(task_id), "t%08x", (unsigned)(size_t)timer_task->task_func);
+        print_task_stats(worker_thread->name, task_id, &stats);
+    }
+
+#ifdef MODULE_PUBSUB_ENABLED
+    // Listener tasks are identified by the topic they listen to
+    struct worker_thread_listener_task_s* listener_task = NULL;
+    while (worker_thread_iterate_listener_tasks(worker_thread, &listener_task)) {
+        worker_thread_listener_task_get_stats(listener_task, &stats, true);
+        const char* topic_name = pubsub_topic_get_name(listener_task->listener.topic);
+        if (topic_name) {
+            snprintf(task_id, sizeof(task_id), "l:%s", topic_name);
+        } else {
+            snprintf(task_id, sizeof(task_id), "l%08x", (unsigned)pubsub_topic_get_id(listener_task->listener.topic));
+        }
+        print_task_stats(worker_thread->name, task_id, &stats);
+    }
+#endif
+}
+
+static void stats_print_task_func(struct worker_thread_timer_task_s* task) {
+    (void)task;
+
+    struct worker_thread_s* worker_thread = NULL;
+    while (worker_thread_iterate_worker_threads(&worker_thread)) {
+        print_worker_thread_stats(worker_thread);
+    }
+}
@@ -0,0 +1 @@
+UDEFS += -DWORKER_THREAD_WATCHDOG_ENABLED=TRUE
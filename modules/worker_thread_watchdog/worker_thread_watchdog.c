@@ -0,0 +1,162 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "worker_thread_watchdog.h"
+#include <common/ctor.h>
+#include <common/helpers.h>
+#include <ch.h>
+#include <hal.h>
+
+#ifdef MODULE_UAVCAN_DEBUG_ENABLED
+#include <modules/uavcan_debug/uavcan_debug.h>
+#endif
+
+#if !WORKER_THREAD_WATCHDOG_ENABLED
+#error worker_thread_watchdog requires WORKER_THREAD_WATCHDOG_ENABLED.
+#endif
+
+// Overrun events are published, and printed, from this worker thread. Overruns of its own tasks are only reported once the
+// offending task returns.
+#ifndef WORKER_THREAD_WATCHDOG_WORKER_THREAD
+#error Please define WORKER_THREAD_WATCHDOG_WORKER_THREAD in framework_conf.h.
+#endif
+
+#ifndef WORKER_THREAD_WATCHDOG_CHECK_INTERVAL
+#define WORKER_THREAD_WATCHDOG_CHECK_INTERVAL MS2ST(5)
+#endif
+
+#ifndef WORKER_THREAD_WATCHDOG_OVERRUN_QUEUE_DEPTH
+#define WORKER_THREAD_WATCHDOG_OVERRUN_QUEUE_DEPTH 4
+#endif
+
+// If enabled, the IWDG is started at boot and only fed on checks where every worker thread has made progress since the
+// previous check (see worker_thread_check_progress_I) and none is running a task past its runtime budget. A single task
+// must therefore never run for longer than the IWDG timeout, whatever its runtime budget.
+#ifndef WORKER_THREAD_WATCHDOG_IWDG_ENABLED
+#define WORKER_THREAD_WATCHDOG_IWDG_ENABLED FALSE
+#endif
+
+#ifndef WORKER_THREAD_WATCHDOG_IWDG_TIMEOUT_MS
+#define WORKER_THREAD_WATCHDOG_IWDG_TIMEOUT_MS 500
+#endif
+
+#define WT WORKER_THREAD_WATCHDOG_WORKER_THREAD
+WORKER_THREAD_DECLARE_EXTERN(WT)
+
+struct pubsub_topic_s worker_thread_watchdog_overrun_topic;
+
+static virtual_timer_t check_timer;
+static struct worker_thread_channel_task_s overrun_channel_task;
+static void check_timer_cb(void* arg);
+
+#ifdef MODULE_UAVCAN_DEBUG_ENABLED
+static struct worker_thread_listener_task_s overrun_print_task;
+static void overrun_print_handler(size_t msg_size, const void* buf, void* ctx);
+#endif
+
+#if WORKER_THREAD_WATCHDOG_IWDG_ENABLED
+static void iwdg_start(void);
+#endif
+
+RUN_ON(PUBSUB_TOPIC_INIT) {
+    pubsub_init_named_topic(&worker_thread_watchdog_overrun_topic, NULL, "worker_thread_overrun");
+}
+
+RUN_AFTER(WORKER_THREADS_INIT) {
+    worker_thread_add_channel_task(&WT, &overrun_channel_task, sizeof(struct worker_thread_runtime_overrun_s), WORKER_THREAD_WATCHDOG_OVERRUN_QUEUE_DEPTH, NULL, NULL);
+#ifdef MODULE_UAVCAN_DEBUG_ENABLED
+    worker_thread_add_listener_task(&WT, &overrun_print_task, &worker_thread_watchdog_overrun_topic, overrun_print_handler, NULL);
+#endif
+
+#if WORKER_THREAD_WATCHDOG_IWDG_ENABLED
+    iwdg_start();
+#endif
+
+    chVTObjectInit(&check_timer);
+    chVTSet(&check_timer, WORKER_THREAD_WATCHDOG_CHECK_INTERVAL, check_timer_cb, NULL);
+}
+
+// Runs from the system tick interrupt, so tasks are checked even while every worker thread is busy
+static void check_timer_cb(void* arg) {
+    (void)arg;
+
+    chSysLockFromISR();
+    bool all_within_budget = true;
+    bool all_progressing = true;
+
+    struct worker_thread_s* worker_thread = NULL;
+    while (worker_thread_iterate_worker_threads(&worker_thread)) {
+        struct worker_thread_runtime_overrun_s overrun;
+        switch (worker_thread_check_runtime_budget_I(worker_thread, &overrun)) {
+            case WORKER_THREAD_RUNTIME_WITHIN_BUDGET:
+                break;
+            case WORKER_THREAD_RUNTIME_OVERRUN_NEW:
+                worker_thread_channel_task_publish_I(&overrun_channel_task, &worker_thread_watchdog_overrun_topic, sizeof(overrun), pubsub_copy_writer_func, &overrun);
+                all_within_budget = false;
+                break;
+            case WORKER_THREAD_RUNTIME_OVERRUN:
+                all_within_budget = false;
+                break;
+        }
+
+        // Checked for every worker thread, so that each one's progress is measured from this check
+        if (!worker_thread_check_progress_I(worker_thread)) {
+            all_progressing = false;
+        }
+    }
+
+#if WORKER_THREAD_WATCHDOG_IWDG_ENABLED
+    if (all_within_budget && all_progressing) {
+        IWDG->KR = 0xAAAA;
+    }
+#else
+    (void)all_within_budget;
+    (void)all_progressing;
+#endif
+
+    chVTSetI(&check_timer, WORKER_THREAD_WATCHDOG_CHECK_INTERVAL, check_timer_cb, NULL);
+    chSysUnlockFromISR();
+}
+
+#ifdef MODULE_UAVCAN_DEBUG_ENABLED
+static void overrun_print_handler(size_t msg_size, const void* buf, void* ctx) {
+    (void)msg_size;
+    (void)ctx;
+    const struct worker_thread_runtime_overrun_s* overrun = buf;
+
+    // Tasks are identified by address, see the map file
+    uavcan_send_debug_msg(UAVCAN_PROTOCOL_DEBUG_LOGLEVEL_WARNING, "wt", "%s task %p func %p ran %uus, budget %uus", overrun->worker_thread->name,
+        overrun->task, overrun->task_func, (unsigned)ST2US(overrun->elapsed_ticks), (unsigned)ST2US(overrun->budget_ticks));
+}
+#endif
+
+#if WORKER_THREAD_WATCHDOG_IWDG_ENABLED
+static void iwdg_start(void) {
+    // Pick the smallest prescaler (4 << prescaler_bits) whose timeout fits in the 12-bit reload register
+    uint32_t prescaler_bits = 0;
+    uint32_t reload = (uint32_t)(((uint64_t)WORKER_THREAD_WATCHDOG_IWDG_TIMEOUT_MS*STM32_LSICLK)/(1000*4));
+    while (reload > 0xFFF && prescaler_bits < 6) {
+        prescaler_bits++;
+        reload >>= 1;
+    }
+
+    IWDG->KR = 0xCCCC;
+    IWDG->KR = 0x5555;
+    IWDG->PR = prescaler_bits;
+    IWDG->RLR = MIN(reload, 0xFFF);
+    while (IWDG->SR);
+    IWDG->KR = 0xAAAA;
+}
+#endif
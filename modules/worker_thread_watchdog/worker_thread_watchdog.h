@@ -0,0 +1,8 @@
+#pragma once
+
+#include <modules/worker_thread/worker_thread.h>
+#include <modules/pubsub/pubsub.h>
+
+// - A struct worker_thread_runtime_overrun_s is published on this topic the first time each run of a task is seen over its
+//   runtime budget. elapsed_ticks is how long the task had run when it was seen, not its total runtime.
+extern struct pubsub_topic_s worker_thread_watchdog_overrun_topic;
@@ -16,6 +16,7 @@
 #include <common/helpers.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 
 float wrap_1(float x) {
     volatile float z = (x + 25165824.0f);
@@ -138,3 +139,24 @@ uint32_t crc32(const uint8_t *buf, uint32_t len, uint32_t crc)
     }
     return ~crc;
 }
+
+uint32_t format_log2_histogram(char* buf, size_t buf_size, const uint32_t* histogram, size_t num_bins) {
+    if (buf_size > 0) {
+        buf[0] = '\0';
+    }
+    if (num_bins == 0) {
+        return 0;
+    }
+
+    size_t first_bin = 0;
+    while (first_bin < num_bins-1 && histogram[first_bin] == 0) {
+        first_bin++;
+    }
+
+    int len = 0;
+    for (size_t i=first_bin; i<num_bins && len < (int)buf_size; i++) {
+        len += snprintf(&buf[len], buf_size-len, " %u", (unsigned)histogram[i]);
+    }
+
+    return first_bin == 0 ? 0U : 1UL<<(first_bin-1);
+}
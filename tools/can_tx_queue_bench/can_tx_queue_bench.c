@@ -0,0 +1,202 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the CAN TX queue backends with 64, 256 and 1024 frames queued, using UAVCAN-shaped extended IDs:
+// - push: filling the empty queue, per frame.
+// - pop+push: popping the highest priority frame and pushing a new one, with the queue staying full.
+// - xfer/xfer_1by1: pushing a TRANSFER_FRAMES frame transfer onto the full queue, per transfer, with
+//   can_tx_queue_push_list_I and with one can_tx_queue_push_I per frame.
+// - remove: removing frames in random order until the queue is empty, per frame.
+// Each figure is the best of several runs, in nanoseconds of host time. The queue order is checked along the way.
+//
+// Usage: can_tx_queue_bench [-r runs]
+
+#include <ch.h>
+#include <modules/can/can_tx_queue.h>
+#include <modules/can/can_helpers.h>
+#include <common/helpers.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_QUEUED_FRAMES 1024
+#define TRANSFER_FRAMES 16
+
+static const size_t queue_lengths[] = { 64, 256, 1024 };
+
+static struct can_tx_frame_s frames[2*MAX_QUEUED_FRAMES];
+static struct can_tx_frame_s* remove_order[MAX_QUEUED_FRAMES];
+static struct can_tx_frame_s transfer_frames[TRANSFER_FRAMES];
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Mostly the default priority, with some traffic above and below it
+static void fill_frame(struct can_tx_frame_s* frame) {
+    static const uint8_t priorities[] = { 8, 16, 16, 16, 16, 24, 30, 31 };
+
+    memset(frame, 0, sizeof(*frame));
+    frame->content.IDE = 1;
+    frame->content.DLC = 8;
+    frame->content.EID = ((uint32_t)priorities[rand() % 8] << 24) | ((uint32_t)(rand() & 0xFFFF) << 8) | (uint32_t)(rand() & 0x7F);
+    frame->tx_timeout = TIME_INFINITE;
+}
+
+static void check_order(enum can_tx_queue_type_t type, struct can_tx_frame_s* prev_frame, struct can_tx_frame_s* frame) {
+    if (!prev_frame) {
+        return;
+    }
+
+    // The list sorts by the whole ID, the buckets only by priority class
+    can_frame_priority_t mask = type == CAN_TX_QUEUE_LIST ? 0xFFFFFFFF : 0xF8000000;
+    if ((can_get_tx_frame_priority_X(frame) & mask) > (can_get_tx_frame_priority_X(prev_frame) & mask)) {
+        fprintf(stderr, "queue order violated\n");
+        exit(1);
+    }
+}
+
+struct result_s {
+    uint64_t push_ns;
+    uint64_t pop_push_ns;
+    uint64_t xfer_ns;
+    uint64_t xfer_1by1_ns;
+    uint64_t remove_ns;
+};
+
+static void run_once(enum can_tx_queue_type_t type, size_t len, struct result_s* result) {
+    struct can_tx_queue_s queue;
+    can_tx_queue_init(&queue, type);
+
+    for (size_t i=0; i<2*len; i++) {
+        fill_frame(&frames[i]);
+    }
+
+    uint64_t t0 = get_time_ns();
+    for (size_t i=0; i<len; i++) {
+        can_tx_queue_push_I(&queue, &frames[i]);
+    }
+    uint64_t t1 = get_time_ns();
+
+    // Each frame popped is pushed back straight away with a fresh ID, taking turns with the spare half of the array
+    for (size_t i=0; i<len; i++) {
+        can_tx_queue_pop_I(&queue);
+        can_tx_queue_push_I(&queue, &frames[len+i]);
+    }
+    uint64_t t2 = get_time_ns();
+
+    // All frames of a transfer share one ID. It is given the lowest priority, like a bulk file read reply, so the list has
+    // to be walked to its end.
+    fill_frame(&transfer_frames[0]);
+    transfer_frames[0].content.EID |= 31UL << 24;
+    for (size_t i=0; i<TRANSFER_FRAMES; i++) {
+        transfer_frames[i] = transfer_frames[0];
+        transfer_frames[i].next = i+1 < TRANSFER_FRAMES ? &transfer_frames[i+1] : NULL;
+    }
+
+    uint64_t t_xfer0 = get_time_ns();
+    can_tx_queue_push_list_I(&queue, &transfer_frames[0]);
+    uint64_t t_xfer1 = get_time_ns();
+    for (size_t i=0; i<TRANSFER_FRAMES; i++) {
+        can_tx_queue_remove_I(&queue, &transfer_frames[i]);
+    }
+
+    uint64_t t_xfer2 = get_time_ns();
+    for (size_t i=0; i<TRANSFER_FRAMES; i++) {
+        can_tx_queue_push_I(&queue, &transfer_frames[i]);
+    }
+    uint64_t t_xfer3 = get_time_ns();
+    for (size_t i=0; i<TRANSFER_FRAMES; i++) {
+        can_tx_queue_remove_I(&queue, &transfer_frames[i]);
+    }
+
+    size_t num_queued = 0;
+    struct can_tx_frame_s* frame = NULL;
+    while (can_tx_queue_iterate_I(&queue, &frame)) {
+        check_order(type, num_queued > 0 ? remove_order[num_queued-1] : NULL, frame);
+        remove_order[num_queued++] = frame;
+    }
+    if (num_queued != len) {
+        fprintf(stderr, "queue holds %zu frames, expected %zu\n", num_queued, len);
+        exit(1);
+    }
+    for (size_t i=len-1; i>0; i--) {
+        size_t j = (size_t)rand() % (i+1);
+        struct can_tx_frame_s* tmp = remove_order[i];
+        remove_order[i] = remove_order[j];
+        remove_order[j] = tmp;
+    }
+
+    uint64_t t3 = get_time_ns();
+    for (size_t i=0; i<len; i++) {
+        can_tx_queue_remove_I(&queue, remove_order[i]);
+    }
+    uint64_t t4 = get_time_ns();
+
+    if (can_tx_queue_peek_I(&queue) != NULL) {
+        fprintf(stderr, "queue not empty after removing every frame\n");
+        exit(1);
+    }
+
+    result->push_ns = (t1-t0)/len;
+    result->pop_push_ns = (t2-t1)/len;
+    result->remove_ns = (t4-t3)/len;
+    result->xfer_ns = t_xfer1-t_xfer0;
+    result->xfer_1by1_ns = t_xfer3-t_xfer2;
+}
+
+int main(int argc, char** argv) {
+    uint32_t runs = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r runs]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    srand(1);
+
+    printf("%-9s %6s %8s %9s %8s %10s %8s\n", "queue", "frames", "push", "pop+push", "xfer", "xfer_1by1", "remove");
+    for (size_t i=0; i<LEN(queue_lengths); i++) {
+        for (int type=CAN_TX_QUEUE_LIST; type<=CAN_TX_QUEUE_BUCKETED; type++) {
+            struct result_s best = { UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX };
+            for (uint32_t run=0; run<runs; run++) {
+                struct result_s result;
+                run_once((enum can_tx_queue_type_t)type, queue_lengths[i], &result);
+                best.push_ns = MIN(best.push_ns, result.push_ns);
+                best.pop_push_ns = MIN(best.pop_push_ns, result.pop_push_ns);
+                best.xfer_ns = MIN(best.xfer_ns, result.xfer_ns);
+                best.xfer_1by1_ns = MIN(best.xfer_1by1_ns, result.xfer_1by1_ns);
+                best.remove_ns = MIN(best.remove_ns, result.remove_ns);
+            }
+            printf("%-9s %6zu %8llu %9llu %8llu %10llu %8llu\n", type == CAN_TX_QUEUE_LIST ? "list" : "bucketed", queue_lengths[i],
+                (unsigned long long)best.push_ns, (unsigned long long)best.pop_push_ns, (unsigned long long)best.xfer_ns,
+                (unsigned long long)best.xfer_1by1_ns, (unsigned long long)best.remove_ns);
+        }
+    }
+    printf("times in ns per frame (xfer, xfer_1by1: per %u frame transfer), best of %u runs\n", (unsigned)TRANSFER_FRAMES, (unsigned)runs);
+
+    return 0;
+}
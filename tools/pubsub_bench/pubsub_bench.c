@@ -0,0 +1,269 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks and stress tests pubsub for every combination of topic group size, listener count and message size:
+// - pub: publishing one message of a burst, average and worst case.
+// - hdl: handling one message once the burst is published, average.
+// - evict: messages evicted before a listener handled them, out of all messages published to all listeners.
+// The stress test then interleaves publishes of random sizes with listeners handling random numbers of messages, on each
+// topic group size. Every listener must see intact messages in order, and every message must be either handled or counted
+// as a miss. Times are in nanoseconds of host time. Exits with an error if any message is corrupt, out of order or lost.
+//
+// Usage: pubsub_bench [-i iterations] [-s stress_iterations]
+
+#include <ch.h>
+#include <common/ctor.h>
+#include <modules/pubsub/pubsub.h>
+#include <common/helpers.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LISTENERS 8
+#define MAX_MSG_SIZE 200
+#define MAX_TOPIC_GROUP_SIZE 16384
+
+PUBSUB_TOPIC_GROUP_CREATE(default_topic_group, 64)
+
+static const size_t topic_group_sizes[] = { 256, 1024, 4096, MAX_TOPIC_GROUP_SIZE };
+static const size_t listener_counts[] = { 1, 2, 4, MAX_LISTENERS };
+static const size_t msg_sizes[] = { 8, 32, 128 };
+
+struct benchmark_msg_s {
+    uint32_t seq;
+    uint8_t payload[];
+};
+
+struct benchmark_listener_s {
+    struct pubsub_listener_s listener;
+    uint32_t last_seq;
+    bool received_any;
+    uint32_t received;
+    uint32_t errors;
+};
+
+static struct pubsub_topic_group_s topic_groups[LEN(topic_group_sizes)];
+static uint8_t topic_group_memory[LEN(topic_group_sizes)][MAX_TOPIC_GROUP_SIZE];
+static struct pubsub_topic_s topics[LEN(topic_group_sizes)];
+
+static struct benchmark_listener_s benchmark_listeners[MAX_LISTENERS];
+static uint32_t benchmark_seq;
+static uint32_t prng_state = 0x2545F491;
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t prng_next(void) {
+    // xorshift32
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 17;
+    prng_state ^= prng_state << 5;
+    return prng_state;
+}
+
+static void benchmark_writer(size_t msg_size, void* buf, void* ctx) {
+    (void)ctx;
+    struct benchmark_msg_s* msg = buf;
+
+    msg->seq = benchmark_seq;
+    for (size_t i=0; i<msg_size-sizeof(struct benchmark_msg_s); i++) {
+        msg->payload[i] = (uint8_t)(i ^ benchmark_seq);
+    }
+}
+
+static void benchmark_handler(size_t msg_size, const void* buf, void* ctx) {
+    struct benchmark_listener_s* benchmark_listener = ctx;
+    const struct benchmark_msg_s* msg = buf;
+
+    if (msg_size < sizeof(struct benchmark_msg_s) || (benchmark_listener->received_any && (int32_t)(msg->seq-benchmark_listener->last_seq) <= 0)) {
+        benchmark_listener->errors++;
+        return;
+    }
+
+    for (size_t i=0; i<msg_size-sizeof(struct benchmark_msg_s); i++) {
+        if (msg->payload[i] != (uint8_t)(i ^ msg->seq)) {
+            benchmark_listener->errors++;
+            return;
+        }
+    }
+
+    benchmark_listener->last_seq = msg->seq;
+    benchmark_listener->received_any = true;
+    benchmark_listener->received++;
+}
+
+static void benchmark_register_listeners(struct pubsub_topic_s* topic, size_t num_listeners) {
+    for (size_t i=0; i<num_listeners; i++) {
+        memset(&benchmark_listeners[i], 0, sizeof(benchmark_listeners[i]));
+        pubsub_listener_init_and_register(&benchmark_listeners[i].listener, topic, benchmark_handler, &benchmark_listeners[i]);
+    }
+}
+
+static void benchmark_unregister_listeners(size_t num_listeners) {
+    for (size_t i=0; i<num_listeners; i++) {
+        pubsub_listener_unregister(&benchmark_listeners[i].listener);
+    }
+}
+
+static uint64_t benchmark_publish(struct pubsub_topic_s* topic, size_t msg_size) {
+    benchmark_seq++;
+
+    uint64_t t0 = get_time_ns();
+    pubsub_publish_message(topic, msg_size, benchmark_writer, NULL);
+    return get_time_ns()-t0;
+}
+
+// - Publishes a burst of messages to num_listeners listeners and then lets every listener handle its messages, measuring the
+//   cost of each publish and handle. Messages that do not fit in the topic group are evicted before they are handled.
+static uint32_t benchmark_run(size_t group_idx, size_t num_listeners, size_t msg_size, uint32_t iterations) {
+    struct pubsub_topic_s* topic = &topics[group_idx];
+
+    benchmark_register_listeners(topic, num_listeners);
+
+    uint64_t publish_ns_total = 0;
+    uint64_t publish_ns_max = 0;
+    for (uint32_t i=0; i<iterations; i++) {
+        uint64_t ns = benchmark_publish(topic, msg_size);
+        publish_ns_total += ns;
+        publish_ns_max = MAX(publish_ns_max, ns);
+    }
+
+    uint64_t handle_ns_total = 0;
+    uint32_t received = 0;
+    uint32_t misses = 0;
+    uint32_t errors = 0;
+    for (size_t i=0; i<num_listeners; i++) {
+        uint64_t t0 = get_time_ns();
+        while (pubsub_listener_handle_one_timeout(&benchmark_listeners[i].listener, TIME_IMMEDIATE));
+        handle_ns_total += get_time_ns()-t0;
+
+        received += benchmark_listeners[i].received;
+        errors += benchmark_listeners[i].errors;
+        misses += benchmark_listeners[i].listener.misses;
+    }
+
+    benchmark_unregister_listeners(num_listeners);
+
+    if (received + misses != num_listeners*iterations) {
+        errors++;
+    }
+
+    printf("%6u %4u %4u %8u %8u %8u %6u/%-6u %4u\n", (unsigned)topic_group_sizes[group_idx], (unsigned)num_listeners, (unsigned)msg_size,
+        (unsigned)(publish_ns_total/iterations), (unsigned)publish_ns_max, received ? (unsigned)(handle_ns_total/received) : 0U,
+        (unsigned)misses, (unsigned)(num_listeners*iterations), (unsigned)errors);
+
+    return errors;
+}
+
+// - Interleaves publishes of random sizes with listeners handling random numbers of messages, and checks that every listener
+//   sees intact messages in order and that every published message is either handled or counted as a miss.
+static uint32_t benchmark_stress(size_t group_idx, uint32_t iterations) {
+    struct pubsub_topic_s* topic = &topics[group_idx];
+    const size_t num_listeners = MAX_LISTENERS;
+    const uint32_t publish_count_begin = pubsub_topic_get_publish_count(topic);
+
+    benchmark_register_listeners(topic, num_listeners);
+
+    for (uint32_t i=0; i<iterations; i++) {
+        if (prng_next() % 2 == 0) {
+            uint32_t count = 1 + prng_next() % 8;
+            while (count--) {
+                size_t msg_size = sizeof(struct benchmark_msg_s) + prng_next() % (MAX_MSG_SIZE-sizeof(struct benchmark_msg_s)+1);
+                benchmark_publish(topic, msg_size);
+            }
+        } else {
+            struct benchmark_listener_s* benchmark_listener = &benchmark_listeners[prng_next() % num_listeners];
+            uint32_t count = prng_next() % 8;
+            while (count-- && pubsub_listener_handle_one_timeout(&benchmark_listener->listener, TIME_IMMEDIATE));
+        }
+    }
+
+    const uint32_t published = pubsub_topic_get_publish_count(topic)-publish_count_begin;
+
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    for (size_t i=0; i<num_listeners; i++) {
+        while (pubsub_listener_handle_one_timeout(&benchmark_listeners[i].listener, TIME_IMMEDIATE));
+
+        received += benchmark_listeners[i].received;
+        errors += benchmark_listeners[i].errors;
+        if (benchmark_listeners[i].received + benchmark_listeners[i].listener.misses != published) {
+            errors++;
+        }
+    }
+
+    benchmark_unregister_listeners(num_listeners);
+
+    printf("stress %6u: %u msgs, %u handled by %u listeners, err %u\n", (unsigned)topic_group_sizes[group_idx], (unsigned)published,
+        (unsigned)received, (unsigned)num_listeners, (unsigned)errors);
+
+    return errors;
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = 256;
+    uint32_t stress_iterations = 20000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:s:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                stress_iterations = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i iterations] [-s stress_iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    for (size_t i=0; i<LEN(topic_group_sizes); i++) {
+        pubsub_create_topic_group(&topic_groups[i], topic_group_sizes[i], topic_group_memory[i]);
+        pubsub_init_topic(&topics[i], &topic_groups[i]);
+    }
+
+    uint32_t errors = 0;
+
+    printf("%6s %4s %4s %8s %8s %8s %13s %4s\n", "group", "lis", "size", "pub_avg", "pub_max", "hdl_avg", "evict", "err");
+    for (size_t i=0; i<LEN(topic_group_sizes); i++) {
+        for (size_t j=0; j<LEN(listener_counts); j++) {
+            for (size_t k=0; k<LEN(msg_sizes); k++) {
+                errors += benchmark_run(i, listener_counts[j], msg_sizes[k], iterations);
+            }
+        }
+    }
+
+    for (size_t i=0; i<LEN(topic_group_sizes); i++) {
+        errors += benchmark_stress(i, stress_iterations);
+    }
+
+    if (errors) {
+        fprintf(stderr, "error: %u messages corrupt, out of order or lost\n", (unsigned)errors);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the worker thread timer queue backends with 10 to 1000 timer tasks queued on a worker thread that is never started:
+// - insert: filling the empty queue with auto-repeat timer tasks of random expiration, per task.
+// - resch: rescheduling a random timer task to a random expiration, which is what dispatching an auto-repeat timer task
+//   costs, average and worst case of a run.
+// - remove: removing the timer tasks in the order they were inserted, per task.
+// Each figure is the best of several runs, in nanoseconds of host time.
+//
+// Usage: worker_thread_bench [-r runs]
+
+#include <ch.h>
+#include <modules/worker_thread/worker_thread.h>
+#include <common/helpers.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_TIMERS 1000
+#define RESCHEDULE_ITERATIONS 256
+#define MAX_EXPIRATION_TICKS 10000
+
+static const size_t timer_counts[] = { 10, 50, 100, 200, 500, MAX_TIMERS };
+
+struct result_s {
+    uint64_t insert_ns;
+    uint64_t reschedule_ns;
+    uint64_t reschedule_max_ns;
+    uint64_t remove_ns;
+};
+
+// Never started, so its timer tasks are only ever queued, never run
+static struct worker_thread_s benchmark_worker_thread;
+static struct worker_thread_timer_task_s benchmark_timer_tasks[MAX_TIMERS];
+static uint32_t prng_state = 0x2545F491;
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t prng_next(void) {
+    // xorshift32
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 17;
+    prng_state ^= prng_state << 5;
+    return prng_state;
+}
+
+static void benchmark_timer_task_func(struct worker_thread_timer_task_s* task) {
+    (void)task;
+}
+
+static systime_t benchmark_random_expiration(void) {
+    return 1 + prng_next() % MAX_EXPIRATION_TICKS;
+}
+
+static void run_once(enum worker_thread_timer_queue_t timer_queue, size_t num_timers, struct result_s* result) {
+    worker_thread_init(&benchmark_worker_thread, "timer_bench", LOWPRIO);
+    worker_thread_set_timer_queue(&benchmark_worker_thread, timer_queue);
+
+    uint64_t t0 = get_time_ns();
+    chSysLock();
+    for (size_t i=0; i<num_timers; i++) {
+        worker_thread_add_timer_task_I(&benchmark_worker_thread, &benchmark_timer_tasks[i], benchmark_timer_task_func, NULL, benchmark_random_expiration(), true);
+    }
+    chSysUnlock();
+    result->insert_ns = (get_time_ns()-t0)/num_timers;
+
+    uint64_t reschedule_ns_total = 0;
+    result->reschedule_max_ns = 0;
+    for (uint32_t i=0; i<RESCHEDULE_ITERATIONS; i++) {
+        struct worker_thread_timer_task_s* task = &benchmark_timer_tasks[prng_next() % num_timers];
+        systime_t expiration = benchmark_random_expiration();
+        chSysLock();
+        t0 = get_time_ns();
+        worker_thread_timer_task_reschedule_I(&benchmark_worker_thread, task, expiration);
+        uint64_t ns = get_time_ns()-t0;
+        chSysUnlock();
+        reschedule_ns_total += ns;
+        result->reschedule_max_ns = MAX(result->reschedule_max_ns, ns);
+    }
+    result->reschedule_ns = reschedule_ns_total/RESCHEDULE_ITERATIONS;
+
+    t0 = get_time_ns();
+    chSysLock();
+    for (size_t i=0; i<num_timers; i++) {
+        worker_thread_remove_timer_task_I(&benchmark_worker_thread, &benchmark_timer_tasks[i]);
+    }
+    chSysUnlock();
+    result->remove_ns = (get_time_ns()-t0)/num_timers;
+}
+
+int main(int argc, char** argv) {
+    uint32_t runs = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r runs]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    static const enum worker_thread_timer_queue_t timer_queues[] = { WORKER_THREAD_TIMER_QUEUE_LIST, WORKER_THREAD_TIMER_QUEUE_HEAP };
+
+    printf("%-5s %6s %8s %8s %9s %8s\n", "queue", "timers", "insert", "resch", "resch_max", "remove");
+    for (size_t i=0; i<LEN(timer_counts); i++) {
+        for (size_t j=0; j<LEN(timer_queues); j++) {
+            struct result_s best = { UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX };
+            for (uint32_t run=0; run<runs; run++) {
+                struct result_s result;
+                run_once(timer_queues[j], timer_counts[i], &result);
+                best.insert_ns = MIN(best.insert_ns, result.insert_ns);
+                best.reschedule_ns = MIN(best.reschedule_ns, result.reschedule_ns);
+                best.reschedule_max_ns = MIN(best.reschedule_max_ns, result.reschedule_max_ns);
+                best.remove_ns = MIN(best.remove_ns, result.remove_ns);
+            }
+            printf("%-5s %6zu %8llu %8llu %9llu %8llu\n", timer_queues[j] == WORKER_THREAD_TIMER_QUEUE_HEAP ? "heap" : "list", timer_counts[i],
+                (unsigned long long)best.insert_ns, (unsigned long long)best.reschedule_ns, (unsigned long long)best.reschedule_max_ns,
+                (unsigned long long)best.remove_ns);
+        }
+    }
+    printf("times in ns per timer task (resch_max: worst reschedule of a run), best of %u runs\n", (unsigned)runs);
+
+    return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+#define PUBSUB_DEFAULT_TOPIC_GROUP default_topic_group
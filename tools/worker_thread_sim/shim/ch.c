@@ -0,0 +1,272 @@
+#include <ch.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_MAX_EVENTS 256
+
+struct sim_event_s {
+    systime_t t;
+    sim_event_func_ptr func;
+    void* ctx;
+    struct sim_event_s* next;
+};
+
+static struct sim_event_s event_pool[SIM_MAX_EVENTS];
+static struct sim_event_s* event_free_list;
+static struct sim_event_s* event_queue_head;
+static bool event_pool_initialized;
+
+static systime_t sim_time;
+static systime_t sim_end_time;
+static jmp_buf sim_end_jmp;
+
+static thread_t sim_thread = { "main", NORMALPRIO, CH_STATE_CURRENT };
+static msg_t sim_resume_msg;
+
+static void sim_event_pool_init(void) {
+    for (size_t i=0; i<SIM_MAX_EVENTS; i++) {
+        event_pool[i].next = event_free_list;
+        event_free_list = &event_pool[i];
+    }
+    event_pool_initialized = true;
+}
+
+void sim_schedule_event(systime_t t, sim_event_func_ptr func, void* ctx) {
+    if (!event_pool_initialized) {
+        sim_event_pool_init();
+    }
+
+    struct sim_event_s* event = event_free_list;
+    if (!event) {
+        fprintf(stderr, "sim: more than %u pending events\n", SIM_MAX_EVENTS);
+        abort();
+    }
+    event_free_list = event->next;
+
+    event->t = t;
+    event->func = func;
+    event->ctx = ctx;
+
+    // Events due at the same time run in the order they were scheduled
+    struct sim_event_s** insert_ptr = &event_queue_head;
+    while (*insert_ptr && (int32_t)((*insert_ptr)->t - t) <= 0) {
+        insert_ptr = &(*insert_ptr)->next;
+    }
+    event->next = *insert_ptr;
+    *insert_ptr = event;
+}
+
+// - Moves the virtual time forward to t, or to the end of the run if that comes first.
+static void sim_advance_to(systime_t t) {
+    if ((int32_t)(t - sim_end_time) >= 0) {
+        sim_time = sim_end_time;
+        longjmp(sim_end_jmp, 1);
+    }
+    sim_time = t;
+}
+
+// - Runs the first event if it is due at or before t. Returns false if there was none.
+static bool sim_run_next_event_before(systime_t t) {
+    struct sim_event_s* event = event_queue_head;
+    if (!event || (int32_t)(event->t - t) > 0) {
+        return false;
+    }
+
+    if ((int32_t)(event->t - sim_time) > 0) {
+        sim_advance_to(event->t);
+    }
+
+    event_queue_head = event->next;
+    sim_event_func_ptr func = event->func;
+    void* ctx = event->ctx;
+    event->next = event_free_list;
+    event_free_list = event;
+
+    func(ctx);
+    return true;
+}
+
+void sim_consume(systime_t ticks) {
+    systime_t t_end = sim_time + ticks;
+    while (sim_run_next_event_before(t_end));
+    sim_advance_to(t_end);
+}
+
+void sim_run(systime_t end_time, void (*func)(void* arg), void* arg) {
+    sim_end_time = end_time;
+    if (setjmp(sim_end_jmp) == 0) {
+        func(arg);
+    }
+}
+
+void chSysLock(void) {}
+void chSysUnlock(void) {}
+void chSysLockFromISR(void) {}
+void chSysUnlockFromISR(void) {}
+
+void chSysHalt(const char* reason) {
+    fprintf(stderr, "sim: halted: %s\n", reason ? reason : "");
+    abort();
+}
+
+rtcnt_t chSysGetRealtimeCounterX(void) {
+    return sim_time;
+}
+
+systime_t chVTGetSystemTimeX(void) {
+    return sim_time;
+}
+
+systime_t chVTTimeElapsedSinceX(systime_t start) {
+    return sim_time - start;
+}
+
+thread_t* chThdCreate(const thread_descriptor_t* tdp) {
+    (void)tdp;
+    fprintf(stderr, "sim: only one thread is simulated, use worker_thread_takeover\n");
+    abort();
+}
+
+thread_t* chThdGetSelfX(void) {
+    return &sim_thread;
+}
+
+tprio_t chThdSetPriority(tprio_t newprio) {
+    tprio_t oldprio = sim_thread.prio;
+    sim_thread.prio = newprio;
+    return oldprio;
+}
+
+void chRegSetThreadName(const char* name) {
+    sim_thread.name = name;
+}
+
+// - The simulated thread sleeps by running events until one of them resumes it or the timeout expires.
+msg_t chThdSuspendTimeoutS(thread_reference_t* trp, systime_t timeout) {
+    if (timeout == TIME_IMMEDIATE) {
+        return MSG_TIMEOUT;
+    }
+
+    *trp = &sim_thread;
+    sim_thread.state = CH_STATE_SUSPENDED;
+    systime_t deadline = sim_time + timeout;
+    while (*trp) {
+        if (timeout == TIME_INFINITE) {
+            if (!event_queue_head) {
+                // Nothing can ever wake the thread
+                sim_advance_to(sim_end_time);
+            }
+            sim_run_next_event_before(event_queue_head->t);
+        } else if (!sim_run_next_event_before(deadline)) {
+            sim_advance_to(deadline);
+            *trp = NULL;
+            sim_thread.state = CH_STATE_CURRENT;
+            return MSG_TIMEOUT;
+        }
+    }
+    sim_thread.state = CH_STATE_CURRENT;
+    return sim_resume_msg;
+}
+
+void chThdResumeI(thread_reference_t* trp, msg_t msg) {
+    if (*trp) {
+        *trp = NULL;
+        sim_resume_msg = msg;
+    }
+}
+
+void chThdResumeS(thread_reference_t* trp, msg_t msg) {
+    chThdResumeI(trp, msg);
+}
+
+void chThdResume(thread_reference_t* trp, msg_t msg) {
+    chThdResumeI(trp, msg);
+}
+
+void chMtxObjectInit(mutex_t* mp) {
+    mp->owner = NULL;
+}
+
+void chMtxLock(mutex_t* mp) {
+    mp->owner = &sim_thread;
+}
+
+void chMtxLockS(mutex_t* mp) {
+    mp->owner = &sim_thread;
+}
+
+void chMtxUnlock(mutex_t* mp) {
+    mp->owner = NULL;
+}
+
+void* chCoreAllocAlignedI(size_t size, unsigned align) {
+    void* ret = NULL;
+    if (posix_memalign(&ret, align < sizeof(void*) ? sizeof(void*) : align, size) != 0) {
+        return NULL;
+    }
+    return ret;
+}
+
+void* chCoreAllocAligned(size_t size, unsigned align) {
+    return chCoreAllocAlignedI(size, align);
+}
+
+void* chCoreAllocI(size_t size) {
+    return chCoreAllocAlignedI(size, sizeof(void*));
+}
+
+void chPoolObjectInit(memory_pool_t* mp, size_t size, void* provider) {
+    (void)provider;
+    mp->object_size = size;
+    mp->next = NULL;
+}
+
+void chPoolAddI(memory_pool_t* mp, void* objp) {
+    *(void**)objp = mp->next;
+    mp->next = objp;
+}
+
+void* chPoolAllocI(memory_pool_t* mp) {
+    void* objp = mp->next;
+    if (objp) {
+        mp->next = *(void**)objp;
+    }
+    return objp;
+}
+
+void chPoolFree(memory_pool_t* mp, void* objp) {
+    chPoolAddI(mp, objp);
+}
+
+void chMBObjectInit(mailbox_t* mbp, msg_t* buf, size_t n) {
+    mbp->buffer = buf;
+    mbp->size = n;
+    mbp->rd = 0;
+    mbp->cnt = 0;
+}
+
+msg_t chMBPostI(mailbox_t* mbp, msg_t msg) {
+    if (mbp->cnt == mbp->size) {
+        return MSG_TIMEOUT;
+    }
+    mbp->buffer[(mbp->rd+mbp->cnt) % mbp->size] = msg;
+    mbp->cnt++;
+    return MSG_OK;
+}
+
+msg_t chMBFetch(mailbox_t* mbp, msg_t* msgp, systime_t timeout) {
+    (void)timeout;
+    if (mbp->cnt == 0) {
+        return MSG_TIMEOUT;
+    }
+    *msgp = mbp->buffer[mbp->rd];
+    mbp->rd = (mbp->rd+1) % mbp->size;
+    mbp->cnt--;
+    return MSG_OK;
+}
+
+size_t chMBGetUsedCountI(mailbox_t* mbp) {
+    return mbp->cnt;
+}
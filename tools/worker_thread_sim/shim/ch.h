@@ -0,0 +1,147 @@
+#pragma once
+
+// Minimal ChibiOS/RT API for building worker_thread and pubsub on a Linux host. There is a single simulated thread, and
+// time only moves when the simulator moves it: while the thread is suspended, and when a task calls sim_consume.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <framework_conf.h>
+
+#define TRUE 1
+#define FALSE 0
+
+typedef uint32_t systime_t;
+typedef uint32_t rtcnt_t;
+typedef intptr_t msg_t;
+typedef uint32_t tprio_t;
+typedef uint32_t stkalign_t;
+typedef uint8_t tstate_t;
+
+#define CH_STATE_CURRENT 1
+#define CH_STATE_SUSPENDED 3
+
+typedef struct ch_thread {
+    const char* name;
+    tprio_t prio;
+    tstate_t state;
+} thread_t;
+typedef thread_t* thread_reference_t;
+
+typedef struct {
+    thread_t* owner;
+} mutex_t;
+
+typedef struct {
+    size_t object_size;
+    void* next;
+} memory_pool_t;
+
+typedef struct {
+    msg_t* buffer;
+    size_t size;
+    size_t rd;
+    size_t cnt;
+} mailbox_t;
+
+typedef struct {
+    const char* name;
+    stkalign_t* wbase;
+    stkalign_t* wend;
+    tprio_t prio;
+    void (*funcp)(void* arg);
+    void* arg;
+} thread_descriptor_t;
+
+#define MSG_OK ((msg_t)0)
+#define MSG_TIMEOUT ((msg_t)-1)
+#define MSG_RESET ((msg_t)-2)
+
+#define TIME_IMMEDIATE ((systime_t)0)
+#define TIME_INFINITE ((systime_t)-1)
+
+#define LOWPRIO 1
+#define NORMALPRIO 128
+#define HIGHPRIO 255
+
+// One tick is one microsecond, as with the default CH_CFG_ST_FREQUENCY
+#define CH_CFG_ST_FREQUENCY 1000000
+#define S2ST(n) ((systime_t)(n)*1000000U)
+#define MS2ST(n) ((systime_t)(n)*1000U)
+#define US2ST(n) ((systime_t)(n))
+#define LL_S2ST(n) S2ST(n)
+#define LL_MS2ST(n) MS2ST(n)
+#define LL_US2ST(n) US2ST(n)
+#define ST2US(n) ((uint32_t)(n))
+#define ST2MS(n) ((uint32_t)(n)/1000U)
+
+#define PORT_WORKING_AREA_ALIGN sizeof(stkalign_t)
+#define THD_WORKING_AREA_SIZE(n) (n)
+#define THD_WORKING_AREA_BASE(p) ((stkalign_t*)(p))
+#define THD_FUNCTION(tname, arg) void tname(void* arg)
+
+// As in ChibiOS, checks stay compiled but are skipped when CH_DBG_ENABLE_CHECKS/CH_DBG_ENABLE_ASSERTS are FALSE
+#ifndef CH_DBG_ENABLE_CHECKS
+#define CH_DBG_ENABLE_CHECKS TRUE
+#endif
+
+#ifndef CH_DBG_ENABLE_ASSERTS
+#define CH_DBG_ENABLE_ASSERTS TRUE
+#endif
+
+#define chDbgCheck(c) do { if (CH_DBG_ENABLE_CHECKS) { assert(c); } } while (0)
+#define chDbgAssert(c, r) do { if (CH_DBG_ENABLE_ASSERTS) { assert((c) && (r)); } } while (0)
+#define chDbgCheckClassI()
+#define chDbgCheckClassS()
+
+void chSysLock(void);
+void chSysUnlock(void);
+void chSysLockFromISR(void);
+void chSysUnlockFromISR(void);
+void chSysHalt(const char* reason);
+rtcnt_t chSysGetRealtimeCounterX(void);
+
+systime_t chVTGetSystemTimeX(void);
+systime_t chVTTimeElapsedSinceX(systime_t start);
+
+thread_t* chThdCreate(const thread_descriptor_t* tdp);
+thread_t* chThdGetSelfX(void);
+tprio_t chThdSetPriority(tprio_t newprio);
+void chRegSetThreadName(const char* name);
+msg_t chThdSuspendTimeoutS(thread_reference_t* trp, systime_t timeout);
+void chThdResumeI(thread_reference_t* trp, msg_t msg);
+void chThdResumeS(thread_reference_t* trp, msg_t msg);
+void chThdResume(thread_reference_t* trp, msg_t msg);
+
+void chMtxObjectInit(mutex_t* mp);
+void chMtxLock(mutex_t* mp);
+void chMtxLockS(mutex_t* mp);
+void chMtxUnlock(mutex_t* mp);
+
+void* chCoreAllocAlignedI(size_t size, unsigned align);
+void* chCoreAllocAligned(size_t size, unsigned align);
+void* chCoreAllocI(size_t size);
+
+void chPoolObjectInit(memory_pool_t* mp, size_t size, void* provider);
+void chPoolAddI(memory_pool_t* mp, void* objp);
+void* chPoolAllocI(memory_pool_t* mp);
+void chPoolFree(memory_pool_t* mp, void* objp);
+
+void chMBObjectInit(mailbox_t* mbp, msg_t* buf, size_t n);
+msg_t chMBPostI(mailbox_t* mbp, msg_t msg);
+msg_t chMBFetch(mailbox_t* mbp, msg_t* msgp, systime_t timeout);
+size_t chMBGetUsedCountI(mailbox_t* mbp);
+
+// - Simulator control. Events stand in for interrupts and higher-priority threads: they run to completion at their
+//   scheduled time, in between the simulated thread's own steps.
+typedef void (*sim_event_func_ptr)(void* ctx);
+
+void sim_schedule_event(systime_t t, sim_event_func_ptr func, void* ctx);
+
+// - Spends ticks of simulated CPU time in the running task. Events that fall due meanwhile run at their scheduled time.
+void sim_consume(systime_t ticks);
+
+// - Runs func(arg) as the simulated thread until the virtual time reaches end_time. func is abandoned at that point,
+//   wherever it is.
+void sim_run(systime_t end_time, void (*func)(void* arg), void* arg);
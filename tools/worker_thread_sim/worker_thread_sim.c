@@ -0,0 +1,254 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs a scripted load on one worker thread in virtual time and reports per-task dispatch latency and missed deadlines.
+// Every run of the same scenario gives the same results, so scheduler changes can be compared run against run.
+// Exits with an error if a timer task that was rescheduled rather than removed is missing from the task statistics.
+// Afterwards, a coroutine awaits messages on a worker thread with nothing else to do, so it sleeps without a timeout and only
+// a publish can wake it. Exits with an error if the coroutine does not handle every message as soon as it is published.
+//
+// Usage: worker_thread_sim [-d duration_ms] [-q list|heap] [-t]
+//   -t prints every dispatch, in order, with the virtual time in microseconds.
+
+#include <ch.h>
+#include <modules/worker_thread/worker_thread.h>
+#include <modules/pubsub/pubsub.h>
+#include <common/helpers.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+PUBSUB_TOPIC_GROUP_CREATE(default_topic_group, 4096)
+
+struct sim_task_s {
+    const char* name;
+    uint8_t priority;
+    systime_t cost;
+    uint32_t dispatch_count;
+    uint64_t total_latency;
+    systime_t min_latency;
+    systime_t max_latency;
+};
+
+struct sim_publisher_s {
+    struct pubsub_topic_s* topic;
+    systime_t period;
+    uint32_t burst;
+};
+
+static struct worker_thread_s sim_worker_thread;
+static bool trace;
+
+static struct sim_task_s esc_command_task = { .name = "esc_command", .priority = 2, .cost = US2ST(30) };
+static struct sim_task_s control_task = { .name = "control", .priority = 1, .cost = US2ST(200) };
+static struct sim_task_s log_task = { .name = "log", .priority = 0, .cost = US2ST(250) };
+static struct sim_task_s housekeeping_task = { .name = "housekeeping", .priority = 0, .cost = US2ST(3000) };
+static struct sim_task_s irq_task = { .name = "irq_deferred", .priority = 0, .cost = US2ST(15) };
+static struct sim_task_s link_timeout_task = { .name = "link_timeout", .priority = 2, .cost = US2ST(50) };
+static struct sim_task_s coroutine_task = { .name = "coroutine", .priority = 0, .cost = US2ST(40) };
+
+static struct pubsub_topic_s esc_command_topic;
+static struct pubsub_topic_s log_topic;
+static struct pubsub_topic_s coroutine_topic;
+
+static struct sim_publisher_s esc_command_publisher = { .topic = &esc_command_topic, .period = US2ST(2500), .burst = 1 };
+static struct sim_publisher_s log_publisher = { .topic = &log_topic, .period = US2ST(5000), .burst = 4 };
+static struct sim_publisher_s coroutine_publisher = { .topic = &coroutine_topic, .period = US2ST(7100), .burst = 1 };
+
+static struct worker_thread_listener_task_s esc_command_listener_task;
+static struct worker_thread_listener_task_s log_listener_task;
+static struct worker_thread_timer_task_s control_timer_task;
+static struct worker_thread_timer_task_s housekeeping_timer_task;
+static struct worker_thread_timer_task_s link_timeout_timer_task;
+
+// Has no timer tasks, so its worker thread sleeps without a timeout
+static struct worker_thread_s coroutine_worker_thread;
+static struct worker_thread_coroutine_task_s coroutine_worker_task;
+static struct pubsub_listener_s coroutine_listener;
+
+// Each esc command pushes the link timeout back, so it only fires if commands stop arriving
+static const systime_t link_timeout = MS2ST(5);
+
+static const systime_t irq_period = US2ST(3300);
+
+static void sim_task_run(struct sim_task_s* task, systime_t latency) {
+    if (trace) {
+        printf("%10u %s late %u\n", (unsigned)chVTGetSystemTimeX(), task->name, (unsigned)latency);
+    }
+
+    if (task->dispatch_count == 0 || latency < task->min_latency) {
+        task->min_latency = latency;
+    }
+    task->max_latency = MAX(task->max_latency, latency);
+    task->total_latency += latency;
+    task->dispatch_count++;
+
+    sim_consume(task->cost);
+}
+
+static void listener_handler(size_t msg_size, const void* buf, void* ctx) {
+    (void)msg_size;
+    const systime_t* publish_systime = buf;
+    sim_task_run(ctx, chVTTimeElapsedSinceX(*publish_systime));
+
+    if (ctx == &esc_command_task) {
+        worker_thread_timer_task_reschedule(&sim_worker_thread, &link_timeout_timer_task, link_timeout);
+    }
+}
+
+static void timer_handler(struct worker_thread_timer_task_s* timer_task) {
+    systime_t due_systime = timer_task->timer_begin_systime + timer_task->timer_expiration_ticks;
+    sim_task_run(worker_thread_task_get_user_context(timer_task), chVTTimeElapsedSinceX(due_systime));
+}
+
+static void coroutine_func(struct worker_thread_coroutine_task_s* task) {
+    WORKER_THREAD_COROUTINE_BEGIN(task);
+    while (true) {
+        WORKER_THREAD_COROUTINE_AWAIT_MESSAGE(task, &coroutine_listener);
+        pubsub_listener_handle_one_timeout(&coroutine_listener, TIME_IMMEDIATE);
+    }
+    WORKER_THREAD_COROUTINE_END(task);
+}
+
+static void irq_deferred_work(void* arg) {
+    // The time the interrupt fired is carried in the argument itself, so that nothing has to stay allocated
+    sim_task_run(&irq_task, chVTTimeElapsedSinceX((systime_t)(uintptr_t)arg));
+}
+
+static void publisher_event(void* ctx) {
+    struct sim_publisher_s* publisher = ctx;
+
+    systime_t publish_systime = chVTGetSystemTimeX();
+    for (uint32_t i=0; i<publisher->burst; i++) {
+        pubsub_publish_message(publisher->topic, sizeof(publish_systime), pubsub_copy_writer_func, &publish_systime);
+    }
+
+    sim_schedule_event(publish_systime + publisher->period, publisher_event, publisher);
+}
+
+static void irq_event(void* ctx) {
+    (void)ctx;
+
+    systime_t tnow = chVTGetSystemTimeX();
+    chSysLockFromISR();
+    worker_thread_defer_I(&sim_worker_thread, irq_deferred_work, (void*)(uintptr_t)tnow);
+    chSysUnlockFromISR();
+
+    sim_schedule_event(tnow + irq_period, irq_event, NULL);
+}
+
+static void sim_thread_func(void* arg) {
+    worker_thread_takeover(arg);
+}
+
+static bool timer_task_has_stats(struct worker_thread_timer_task_s* check_task) {
+    struct worker_thread_timer_task_s* task = NULL;
+    while (worker_thread_iterate_timer_tasks(&sim_worker_thread, &task)) {
+        if (task == check_task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void print_task(const struct sim_task_s* task, uint32_t missed_deadlines) {
+    unsigned avg_latency = task->dispatch_count ? (unsigned)(task->total_latency/task->dispatch_count) : 0;
+    printf("%-14s %4u %8u %8u %8u %8u %8u\n", task->name, (unsigned)task->priority, (unsigned)task->dispatch_count,
+        (unsigned)task->min_latency, avg_latency, (unsigned)task->max_latency, (unsigned)missed_deadlines);
+}
+
+int main(int argc, char** argv) {
+    uint32_t duration_ms = 1000;
+    enum worker_thread_timer_queue_t timer_queue = WORKER_THREAD_TIMER_QUEUE_LIST;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:q:t")) != -1) {
+        switch (opt) {
+            case 'd':
+                duration_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                timer_queue = strcmp(optarg, "heap") == 0 ? WORKER_THREAD_TIMER_QUEUE_HEAP : WORKER_THREAD_TIMER_QUEUE_LIST;
+                break;
+            case 't':
+                trace = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d duration_ms] [-q list|heap] [-t]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    worker_thread_init(&sim_worker_thread, "sim", NORMALPRIO);
+    worker_thread_set_timer_queue(&sim_worker_thread, timer_queue);
+
+    pubsub_init_topic(&esc_command_topic, NULL);
+    pubsub_init_topic(&log_topic, NULL);
+
+    worker_thread_add_listener_task(&sim_worker_thread, &esc_command_listener_task, &esc_command_topic, listener_handler, &esc_command_task);
+    worker_thread_listener_task_set_priority(&esc_command_listener_task, esc_command_task.priority);
+    worker_thread_add_listener_task(&sim_worker_thread, &log_listener_task, &log_topic, listener_handler, &log_task);
+    worker_thread_listener_task_set_priority(&log_listener_task, log_task.priority);
+
+    worker_thread_add_periodic_timer_task(&sim_worker_thread, &control_timer_task, timer_handler, &control_task, US2ST(1000), WORKER_THREAD_TIMER_OVERRUN_SKIP);
+    worker_thread_timer_task_set_priority(&control_timer_task, control_task.priority);
+    worker_thread_add_timer_task(&sim_worker_thread, &housekeeping_timer_task, timer_handler, &housekeeping_task, MS2ST(20), true);
+    worker_thread_timer_task_set_priority(&housekeeping_timer_task, housekeeping_task.priority);
+    worker_thread_timer_task_set_slack(&housekeeping_timer_task, MS2ST(1));
+    worker_thread_add_timer_task(&sim_worker_thread, &link_timeout_timer_task, timer_handler, &link_timeout_task, link_timeout, false);
+    worker_thread_timer_task_set_priority(&link_timeout_timer_task, link_timeout_task.priority);
+
+    // Offset the sources so that they collide some of the time, rather than always or never
+    sim_schedule_event(US2ST(130), publisher_event, &esc_command_publisher);
+    sim_schedule_event(US2ST(400), publisher_event, &log_publisher);
+    sim_schedule_event(US2ST(770), irq_event, NULL);
+
+    sim_run(MS2ST(duration_ms), sim_thread_func, &sim_worker_thread);
+
+    printf("%-14s %4s %8s %8s %8s %8s %8s\n", "task", "prio", "n", "lat_min", "lat_avg", "lat_max", "missed");
+    print_task(&esc_command_task, 0);
+    print_task(&control_task, worker_thread_timer_task_get_missed_deadlines(&control_timer_task));
+    print_task(&log_task, 0);
+    print_task(&housekeeping_task, 0);
+    print_task(&irq_task, worker_thread_get_deferred_work_overruns(&sim_worker_thread));
+    print_task(&link_timeout_task, 0);
+    printf("latencies in us, %u ms simulated, %s timer queue, %u timer wakeups saved\n", (unsigned)duration_ms,
+        timer_queue == WORKER_THREAD_TIMER_QUEUE_HEAP ? "heap" : "list", (unsigned)worker_thread_get_timer_wakeups_saved(&sim_worker_thread));
+
+    if (!timer_task_has_stats(&link_timeout_timer_task)) {
+        fprintf(stderr, "error: rescheduled timer task %s is missing from the task statistics\n", link_timeout_task.name);
+        return 1;
+    }
+
+    // The first scenario's events keep running, but only touch the first worker thread
+    systime_t coroutine_begin = chVTGetSystemTimeX();
+    worker_thread_init(&coroutine_worker_thread, "sim_coroutine", NORMALPRIO);
+    pubsub_init_topic(&coroutine_topic, NULL);
+    pubsub_listener_init_and_register(&coroutine_listener, &coroutine_topic, listener_handler, &coroutine_task);
+    worker_thread_add_coroutine_task(&coroutine_worker_thread, &coroutine_worker_task, coroutine_func, NULL);
+    sim_schedule_event(coroutine_begin + US2ST(530), publisher_event, &coroutine_publisher);
+
+    sim_run(coroutine_begin + MS2ST(duration_ms), sim_thread_func, &coroutine_worker_thread);
+
+    print_task(&coroutine_task, pubsub_topic_get_publish_count(&coroutine_topic)-coroutine_task.dispatch_count);
+
+    if (coroutine_task.dispatch_count != pubsub_topic_get_publish_count(&coroutine_topic) || coroutine_task.max_latency != 0) {
+        fprintf(stderr, "error: coroutine task was not woken by messages published while its worker thread was asleep\n");
+        return 1;
+    }
+
+    return 0;
+}